@@ -0,0 +1,522 @@
+#include <funnel-gbm.h>
+#include <funnel.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <gbm.h>
+#include <libdrm/drm_fourcc.h>
+#include <pipewire/pipewire.h>
+#include <spa/buffer/meta.h>
+#include <spa/param/video/format-utils.h>
+#include <spa/pod/builder.h>
+#include <xf86drm.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
+
+#define WIDTH 256
+#define HEIGHT 256
+#define WARMUP_FRAMES 60
+#define BENCH_FRAMES 600
+#define LINK_TIMEOUT_NS (5 * 1000000000LL)
+
+static const struct {
+    const char *name;
+    enum funnel_sync frontend;
+    enum funnel_sync backend;
+} combinations[] = {
+    {"IMPLICIT/IMPLICIT", FUNNEL_SYNC_IMPLICIT, FUNNEL_SYNC_IMPLICIT},
+    {"EXPLICIT/EXPLICIT", FUNNEL_SYNC_EXPLICIT, FUNNEL_SYNC_EXPLICIT},
+    {"BOTH/BOTH", FUNNEL_SYNC_BOTH, FUNNEL_SYNC_BOTH},
+    {"EXPLICIT/BOTH", FUNNEL_SYNC_EXPLICIT, FUNNEL_SYNC_BOTH},
+    {"EXPLICIT/IMPLICIT", FUNNEL_SYNC_EXPLICIT, FUNNEL_SYNC_IMPLICIT},
+};
+
+static int64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Loopback consumer
+ */
+
+struct consumer_buffer {
+    uint32_t acquire;
+    uint32_t release;
+};
+
+struct consumer {
+    int drm_fd;
+    struct pw_thread_loop *loop;
+    struct pw_context *context;
+    struct pw_core *core;
+    struct pw_stream *stream;
+    struct spa_hook listener;
+
+    /// Written by the producer before each enqueue
+    int64_t last_enqueue_ns;
+
+    /// Updated on the consumer loop thread
+    uint64_t frames;
+    uint64_t explicit_frames;
+    int64_t latency_sum_ns;
+    int64_t latency_max_ns;
+};
+
+static void on_consumer_add_buffer(void *data, struct pw_buffer *pwbuffer) {
+    struct consumer *c = data;
+    struct spa_buffer *buf = pwbuffer->buffer;
+    struct spa_meta_sync_timeline *stl = spa_buffer_find_meta_data(
+        buf, SPA_META_SyncTimeline, sizeof(*stl));
+
+    if (!stl || buf->n_datas < 3)
+        return;
+
+    struct consumer_buffer *cbuf = calloc(1, sizeof(*cbuf));
+    assert(cbuf);
+
+    int ret = drmSyncobjFDToHandle(c->drm_fd, buf->datas[buf->n_datas - 2].fd,
+                                   &cbuf->acquire);
+    assert(ret >= 0);
+    ret = drmSyncobjFDToHandle(c->drm_fd, buf->datas[buf->n_datas - 1].fd,
+                               &cbuf->release);
+    assert(ret >= 0);
+
+    pwbuffer->user_data = cbuf;
+}
+
+static void on_consumer_remove_buffer(void *data, struct pw_buffer *pwbuffer) {
+    struct consumer *c = data;
+    struct consumer_buffer *cbuf = pwbuffer->user_data;
+
+    if (!cbuf)
+        return;
+
+    drmSyncobjDestroy(c->drm_fd, cbuf->acquire);
+    drmSyncobjDestroy(c->drm_fd, cbuf->release);
+    free(cbuf);
+    pwbuffer->user_data = NULL;
+}
+
+static void on_consumer_param_changed(void *data, uint32_t id,
+                                      const struct spa_pod *param) {
+    struct consumer *c = data;
+
+    if (!param || id != SPA_PARAM_Format)
+        return;
+
+    uint8_t buffer[1024];
+    struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+    struct spa_pod_frame f;
+    const struct spa_pod *params[3];
+
+    // Explicit sync variant
+    spa_pod_builder_push_object(&b, &f, SPA_TYPE_OBJECT_ParamBuffers,
+                                SPA_PARAM_Buffers);
+    spa_pod_builder_add(&b, SPA_PARAM_BUFFERS_dataType,
+                        SPA_POD_CHOICE_FLAGS_Int(1 << SPA_DATA_DmaBuf), 0);
+    spa_pod_builder_prop(&b, SPA_PARAM_BUFFERS_metaType,
+                         SPA_POD_PROP_FLAG_MANDATORY);
+    spa_pod_builder_int(&b, 1 << SPA_META_SyncTimeline);
+    params[0] = spa_pod_builder_pop(&b, &f);
+
+    // Implicit sync variant
+    params[1] = spa_pod_builder_add_object(
+        &b, SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+        SPA_PARAM_BUFFERS_dataType,
+        SPA_POD_CHOICE_FLAGS_Int(1 << SPA_DATA_DmaBuf));
+
+    params[2] = spa_pod_builder_add_object(
+        &b, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta, SPA_PARAM_META_type,
+        SPA_POD_Id(SPA_META_SyncTimeline), SPA_PARAM_META_size,
+        SPA_POD_Int(sizeof(struct spa_meta_sync_timeline)));
+
+    pw_stream_update_params(c->stream, params, ARRAY_SIZE(params));
+}
+
+static void on_consumer_process(void *data) {
+    struct consumer *c = data;
+    struct pw_buffer *pwbuffer = pw_stream_dequeue_buffer(c->stream);
+
+    if (!pwbuffer)
+        return;
+
+    struct spa_buffer *buf = pwbuffer->buffer;
+    struct consumer_buffer *cbuf = pwbuffer->user_data;
+    struct spa_meta_sync_timeline *stl = spa_buffer_find_meta_data(
+        buf, SPA_META_SyncTimeline, sizeof(*stl));
+
+    if (cbuf && stl) {
+        // Wait for the producer, then release the buffer right away
+        drmSyncobjTimelineWait(c->drm_fd, &cbuf->acquire, &stl->acquire_point,
+                               1, INT64_MAX,
+                               DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT, NULL);
+#ifdef SPA_META_SYNC_TIMELINE_UNSCHEDULED_RELEASE
+        stl->flags &= ~SPA_META_SYNC_TIMELINE_UNSCHEDULED_RELEASE;
+#endif
+        drmSyncobjTimelineSignal(c->drm_fd, &cbuf->release,
+                                 &stl->release_point, 1);
+        c->explicit_frames++;
+    } else {
+        // Wait for the implicit write fences of the producer
+        struct pollfd pfd = {
+            .fd = buf->datas[0].fd,
+            .events = POLLIN,
+        };
+        poll(&pfd, 1, -1);
+    }
+
+    int64_t enqueued = __atomic_load_n(&c->last_enqueue_ns, __ATOMIC_RELAXED);
+    if (enqueued) {
+        int64_t latency = now_ns(CLOCK_MONOTONIC) - enqueued;
+        c->latency_sum_ns += latency;
+        if (latency > c->latency_max_ns)
+            c->latency_max_ns = latency;
+        c->frames++;
+    }
+
+    pw_stream_queue_buffer(c->stream, pwbuffer);
+}
+
+static const struct pw_stream_events consumer_events = {
+    PW_VERSION_STREAM_EVENTS,
+    .add_buffer = on_consumer_add_buffer,
+    .remove_buffer = on_consumer_remove_buffer,
+    .param_changed = on_consumer_param_changed,
+    .process = on_consumer_process,
+};
+
+static int consumer_start(struct consumer *c, const char *target) {
+    c->loop = pw_thread_loop_new("bench-consumer", NULL);
+    assert(c->loop);
+
+    pw_thread_loop_lock(c->loop);
+    pw_thread_loop_start(c->loop);
+
+    c->context = pw_context_new(pw_thread_loop_get_loop(c->loop), NULL, 0);
+    assert(c->context);
+
+    c->core = pw_context_connect(c->context, NULL, 0);
+    if (!c->core) {
+        pw_thread_loop_unlock(c->loop);
+        return -ECONNREFUSED;
+    }
+
+    // clang-format off
+    struct pw_properties *props = pw_properties_new(
+        PW_KEY_MEDIA_TYPE, "Video",
+        PW_KEY_MEDIA_CATEGORY, "Capture",
+        PW_KEY_TARGET_OBJECT, target,
+        NULL
+    );
+    // clang-format on
+
+    c->stream = pw_stream_new(c->core, "funnel-bench-consumer", props);
+    assert(c->stream);
+    pw_stream_add_listener(c->stream, &c->listener, &consumer_events, c);
+
+    uint8_t buffer[1024];
+    struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+    struct spa_pod_frame f[2];
+
+    spa_pod_builder_push_object(&b, &f[0], SPA_TYPE_OBJECT_Format,
+                                SPA_PARAM_EnumFormat);
+    spa_pod_builder_add(
+        &b, SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video),
+        SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw),
+        SPA_FORMAT_VIDEO_format, SPA_POD_Id(SPA_VIDEO_FORMAT_BGRx),
+        SPA_FORMAT_VIDEO_size,
+        SPA_POD_CHOICE_RANGE_Rectangle(&SPA_RECTANGLE(WIDTH, HEIGHT),
+                                       &SPA_RECTANGLE(1, 1),
+                                       &SPA_RECTANGLE(8192, 8192)),
+        SPA_FORMAT_VIDEO_framerate,
+        SPA_POD_CHOICE_RANGE_Fraction(&SPA_FRACTION(0, 1), &SPA_FRACTION(0, 1),
+                                      &SPA_FRACTION(1000, 1)),
+        0);
+    spa_pod_builder_prop(&b, SPA_FORMAT_VIDEO_modifier,
+                         SPA_POD_PROP_FLAG_MANDATORY |
+                             SPA_POD_PROP_FLAG_DONT_FIXATE);
+    spa_pod_builder_push_choice(&b, &f[1], SPA_CHOICE_Enum, 0);
+    spa_pod_builder_long(&b, DRM_FORMAT_MOD_LINEAR);
+    spa_pod_builder_long(&b, DRM_FORMAT_MOD_LINEAR);
+    spa_pod_builder_pop(&b, &f[1]);
+    const struct spa_pod *params[1] = {spa_pod_builder_pop(&b, &f[0])};
+
+    int ret = pw_stream_connect(c->stream, PW_DIRECTION_INPUT, PW_ID_ANY,
+                                PW_STREAM_FLAG_AUTOCONNECT, params, 1);
+
+    pw_thread_loop_unlock(c->loop);
+    return ret;
+}
+
+static void consumer_stop(struct consumer *c) {
+    if (c->loop)
+        pw_thread_loop_stop(c->loop);
+    if (c->stream)
+        pw_stream_destroy(c->stream);
+    if (c->core)
+        pw_core_disconnect(c->core);
+    if (c->context)
+        pw_context_destroy(c->context);
+    if (c->loop)
+        pw_thread_loop_destroy(c->loop);
+}
+
+/*
+ * Producer
+ */
+
+struct result {
+    uint64_t frames;
+    bool explicit_backend;
+    double cpu_us;
+    double producer_us;
+    double ioctls;
+    double ioctls_skipped;
+    double latency_us;
+    double latency_max_us;
+};
+
+static int produce_frame(struct funnel_stream *stream, int drm_fd,
+                         struct consumer *c) {
+    struct funnel_buffer *buf;
+
+    int ret = funnel_stream_dequeue(stream, &buf);
+    if (ret < 0)
+        return ret;
+    if (!buf)
+        return 0;
+
+    if (funnel_buffer_has_sync(buf)) {
+        uint32_t handle;
+        uint64_t point;
+
+        // Stand-in for rendering: wait for the buffer, then release it
+        // immediately from the CPU.
+        ret = funnel_buffer_get_acquire_sync_object(buf, &handle, &point);
+        assert(ret == 0);
+        drmSyncobjTimelineWait(drm_fd, &handle, &point, 1, INT64_MAX,
+                               DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT, NULL);
+
+        ret = funnel_buffer_get_release_sync_object(buf, &handle, &point);
+        assert(ret == 0);
+        drmSyncobjTimelineSignal(drm_fd, &handle, &point, 1);
+    }
+
+    __atomic_store_n(&c->last_enqueue_ns, now_ns(CLOCK_MONOTONIC),
+                     __ATOMIC_RELAXED);
+
+    ret = funnel_stream_enqueue(stream, buf);
+    return ret < 0 ? ret : 1;
+}
+
+static int run_frames(struct funnel_stream *stream, int drm_fd,
+                      struct consumer *c, int count, int64_t timeout_ns) {
+    int64_t deadline = now_ns(CLOCK_MONOTONIC) + timeout_ns;
+    int frames = 0;
+
+    while (frames < count) {
+        int ret = produce_frame(stream, drm_fd, c);
+        if (ret < 0)
+            return ret;
+
+        if (ret) {
+            frames++;
+        } else {
+            if (now_ns(CLOCK_MONOTONIC) > deadline)
+                return -ETIMEDOUT;
+            usleep(100);
+        }
+    }
+
+    return 0;
+}
+
+static int bench(struct funnel_ctx *ctx, int drm_fd, int index,
+                 struct result *res) {
+    struct funnel_stream *stream;
+    struct consumer c = {.drm_fd = drm_fd};
+    char name[64];
+    int ret;
+
+    snprintf(name, sizeof(name), "funnel-bench-%d-%d", getpid(), index);
+
+    ret = funnel_stream_create(ctx, name, &stream);
+    assert(ret == 0);
+
+    ret = funnel_stream_init_gbm(stream, drm_fd);
+    if (ret < 0)
+        goto out;
+
+    ret = funnel_stream_set_sync(stream, combinations[index].frontend,
+                                 combinations[index].backend);
+    if (ret < 0)
+        goto out;
+
+    uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+    ret = funnel_stream_gbm_add_format(stream, GBM_FORMAT_XRGB8888, &modifier,
+                                       1);
+    assert(ret == 0);
+
+    ret = funnel_stream_set_size(stream, WIDTH, HEIGHT);
+    assert(ret == 0);
+    ret = funnel_stream_set_mode(stream, FUNNEL_ASYNC);
+    assert(ret == 0);
+
+    ret = funnel_stream_configure(stream);
+    if (ret < 0)
+        goto out;
+    ret = funnel_stream_start(stream);
+    if (ret < 0)
+        goto out;
+
+    ret = consumer_start(&c, name);
+    if (ret < 0)
+        goto out;
+
+    ret = run_frames(stream, drm_fd, &c, WARMUP_FRAMES, LINK_TIMEOUT_NS);
+    if (ret < 0)
+        goto out;
+
+    pw_thread_loop_lock(c.loop);
+    c.frames = c.explicit_frames = 0;
+    c.latency_sum_ns = c.latency_max_ns = 0;
+    pw_thread_loop_unlock(c.loop);
+
+    struct funnel_stream_stats before, after;
+    funnel_stream_get_stats(stream, &before);
+    int64_t cpu_start = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+    int64_t thread_start = now_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    ret = run_frames(stream, drm_fd, &c, BENCH_FRAMES, LINK_TIMEOUT_NS);
+    if (ret < 0)
+        goto out;
+
+    int64_t thread_time = now_ns(CLOCK_THREAD_CPUTIME_ID) - thread_start;
+    int64_t cpu_time = now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    funnel_stream_get_stats(stream, &after);
+
+    uint64_t sent = after.frames_sent - before.frames_sent;
+    if (!sent)
+        sent = 1;
+
+    pw_thread_loop_lock(c.loop);
+    res->frames = sent;
+    res->explicit_backend = c.explicit_frames > c.frames / 2;
+    res->cpu_us = cpu_time / 1000.0 / sent;
+    res->producer_us = thread_time / 1000.0 / sent;
+    res->ioctls = (double)(after.sync_ioctls - before.sync_ioctls) / sent;
+    res->ioctls_skipped =
+        (double)(after.sync_ioctls_skipped - before.sync_ioctls_skipped) /
+        sent;
+    res->latency_us = c.frames ? c.latency_sum_ns / 1000.0 / c.frames : 0.0;
+    res->latency_max_us = c.latency_max_ns / 1000.0;
+    pw_thread_loop_unlock(c.loop);
+
+out:
+    // Stop the producer first, so that it does not block on the consumer
+    funnel_stream_stop(stream);
+    consumer_stop(&c);
+    funnel_stream_destroy(stream);
+    return ret;
+}
+
+/*
+ * Device selection: the first render node, then any primary node (for
+ * example vgem, with a software GBM backend).
+ */
+static int open_device(const char *path) {
+    static const char *patterns[] = {"/dev/dri/renderD%d", "/dev/dri/card%d"};
+    static const int bases[] = {128, 0};
+    char node[64];
+
+    if (path)
+        return open(path, O_RDWR | O_CLOEXEC);
+
+    for (int p = 0; p < ARRAY_SIZE(patterns); p++) {
+        for (int i = 0; i < 64; i++) {
+            snprintf(node, sizeof(node), patterns[p], bases[p] + i);
+            int fd = open(node, O_RDWR | O_CLOEXEC);
+            if (fd < 0)
+                continue;
+
+            struct gbm_device *gbm = gbm_create_device(fd);
+            if (gbm) {
+                gbm_device_destroy(gbm);
+                return fd;
+            }
+            close(fd);
+        }
+    }
+
+    return -ENODEV;
+}
+
+int main(int argc, char **argv) {
+    struct funnel_ctx *ctx;
+    int failed = 0;
+
+    const char *device = argc > 1 ? argv[1] : getenv("FUNNEL_BENCH_DEVICE");
+    int drm_fd = open_device(device);
+    if (drm_fd < 0) {
+        fprintf(stderr, "No usable DRM device found\n");
+        return 77; // Skipped
+    }
+
+    drmVersionPtr version = drmGetVersion(drm_fd);
+    printf("Device: %s\n", version ? version->name : "unknown");
+    drmFreeVersion(version);
+
+    int ret = funnel_init(&ctx);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to connect to PipeWire: %d\n", ret);
+        close(drm_fd);
+        return 77; // Skipped
+    }
+
+    printf("%-18s %-8s %7s %10s %10s %8s %8s %10s %10s\n", "frontend/backend",
+           "backend", "frames", "cpu us/f", "prod us/f", "ioctl/f", "skip/f",
+           "lat us", "lat max us");
+
+    for (int i = 0; i < ARRAY_SIZE(combinations); i++) {
+        struct result res = {0};
+
+        ret = bench(ctx, drm_fd, i, &res);
+        if (ret == -EOPNOTSUPP || ret == -EINVAL) {
+            printf("%-18s unsupported on this device\n", combinations[i].name);
+            continue;
+        } else if (ret == -ETIMEDOUT) {
+            printf("%-18s timed out (is a session manager running?)\n",
+                   combinations[i].name);
+            failed++;
+            continue;
+        } else if (ret < 0) {
+            printf("%-18s failed: %s\n", combinations[i].name, strerror(-ret));
+            failed++;
+            continue;
+        }
+
+        printf("%-18s %-8s %7llu %10.2f %10.2f %8.2f %8.2f %10.1f %10.1f\n",
+               combinations[i].name,
+               res.explicit_backend ? "explicit" : "implicit",
+               (unsigned long long)res.frames, res.cpu_us, res.producer_us,
+               res.ioctls, res.ioctls_skipped, res.latency_us,
+               res.latency_max_us);
+    }
+
+    funnel_shutdown(ctx);
+    close(drm_fd);
+
+    return failed ? 1 : 0;
+}
@@ -357,6 +357,8 @@ int main(int argc, char **argv) {
             mode = FUNNEL_DOUBLE_BUFFERED;
         else if (!strcmp(argv[i], "-synchronous"))
             mode = FUNNEL_SYNCHRONOUS;
+        else if (!strcmp(argv[i], "-fifo"))
+            mode = FUNNEL_FIFO;
 
         else if (!strcmp(argv[i], "-implicit_sync"))
             frontend_sync = backend_sync = FUNNEL_SYNC_IMPLICIT;
@@ -437,11 +439,8 @@ int main(int argc, char **argv) {
 
             if (funnel_buffer_has_sync(buf)) {
                 fprintf(stderr, "[%f] Buffer has sync\n", t);
-                EGLSync acquire;
-                ret = funnel_buffer_get_acquire_egl_sync(buf, &acquire);
+                ret = funnel_buffer_wait_acquire_egl_sync(buf);
                 assert(ret == 0);
-                eglWaitSync(egl_display, acquire, 0);
-                eglDestroySync(egl_display, acquire);
                 check_error();
             }
 
@@ -465,11 +464,8 @@ int main(int argc, char **argv) {
             glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER, 0);
 
             if (funnel_buffer_has_sync(buf)) {
-                EGLSync release = eglCreateSync(
-                    egl_display, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
-                ret = funnel_buffer_set_release_egl_sync(buf, release);
+                ret = funnel_buffer_signal_release_egl_sync(buf);
                 assert(ret == 0);
-                eglDestroySync(egl_display, release);
             } else {
                 glFlush();
             }
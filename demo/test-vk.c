@@ -610,6 +610,9 @@ int main(int argc, char **argv) {
         } else if (!strcmp(argv[i], "-synchronous")) {
             mode = FUNNEL_SYNCHRONOUS;
             presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+        } else if (!strcmp(argv[i], "-fifo")) {
+            mode = FUNNEL_FIFO;
+            presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
         } else if (!strcmp(argv[i], "-sync_torture")) {
             iterations = 100;
             width = height = 1024;
@@ -66,6 +66,10 @@ int funnel_buffer_get_egl_image(struct funnel_buffer *buf, EGLImage *pimage);
 /**
  * Get the EGL format for a Funnel buffer.
  *
+ * If funnel_stream_set_prefer_opaque() is enabled, this returns
+ * FUNNEL_EGL_FORMAT_RGB888 whenever the consumer accepted a format without
+ * alpha, even if FUNNEL_EGL_FORMAT_RGBA8888 was added first.
+ *
  * @sync-ext
  *
  * @param buf Buffer @borrowed
@@ -114,3 +118,42 @@ int funnel_buffer_get_acquire_egl_sync(struct funnel_buffer *buf,
  * @retval -EIO Unable to set the release EGLSync (is the sync type correct?)
  */
 int funnel_buffer_set_release_egl_sync(struct funnel_buffer *buf, EGLSync sync);
+
+/**
+ * Make the current OpenGL context wait for the buffer to be acquired.
+ *
+ * This combines funnel_buffer_get_acquire_egl_sync() and eglWaitSync(),
+ * and skips creating an EGLSync entirely if the buffer is already idle.
+ * An OpenGL context must be current on the EGL display of the stream.
+ *
+ * @sync-ext
+ *
+ * @param buf Buffer @borrowed
+ * @return_err
+ * @retval -EINVAL
+ *  * Invalid argument
+ *  * API is not EGL
+ *  * Buffer does not require sync
+ * @retval -EIO Unable to create or wait on the acquire EGLSync
+ */
+int funnel_buffer_wait_acquire_egl_sync(struct funnel_buffer *buf);
+
+/**
+ * Release the buffer once the commands issued so far in the current
+ * OpenGL context complete.
+ *
+ * This creates an EGL_SYNC_NATIVE_FENCE_ANDROID sync object, passes it to
+ * funnel_buffer_set_release_egl_sync(), and destroys it. An OpenGL context
+ * must be current on the EGL display of the stream.
+ *
+ * @sync-ext
+ *
+ * @param buf Buffer @borrowed
+ * @return_err
+ * @retval -EINVAL
+ *  * Invalid argument
+ *  * API is not EGL
+ *  * Buffer does not require sync
+ * @retval -EIO Unable to create or export the release EGLSync
+ */
+int funnel_buffer_signal_release_egl_sync(struct funnel_buffer *buf);
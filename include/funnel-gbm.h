@@ -119,10 +119,53 @@ int funnel_buffer_get_release_sync_object(struct funnel_buffer *buf,
  */
 int funnel_buffer_get_acquire_sync_file(struct funnel_buffer *buf, int *pfd);
 
+/**
+ * Get the sync file for acquiring the buffer, without blocking.
+ *
+ * Like funnel_buffer_get_acquire_sync_file(), but returns -EAGAIN instead
+ * of blocking if the consumer has not yet submitted the work that releases
+ * the buffer. Use funnel_buffer_get_acquire_eventfd() to be notified when
+ * the sync file becomes available.
+ *
+ * @sync-ext
+ *
+ * @param buf Buffer @borrowed
+ * @param[out] pfd Sync file fd for buffer acquisition @owned
+ * @return_err
+ * @retval -EINVAL
+ *  * Invalid argument
+ *  * Buffer does not require sync
+ * @retval -EAGAIN The acquire sync file is not available yet
+ */
+int funnel_buffer_try_get_acquire_sync_file(struct funnel_buffer *buf,
+                                            int *pfd);
+
+/**
+ * Get an eventfd that becomes readable once the acquire sync file of the
+ * buffer is available.
+ *
+ * After the eventfd becomes readable, funnel_buffer_get_acquire_sync_file()
+ * will not block. The eventfd can be added to an event loop, so that the
+ * render thread can keep working (for example, recording command buffers)
+ * in the meantime.
+ *
+ * @sync-ext
+ *
+ * @param buf Buffer @borrowed
+ * @param[out] pfd eventfd @owned
+ * @return_err
+ * @retval -EINVAL
+ *  * Invalid argument
+ *  * Buffer does not require sync
+ * @retval -ENOTSUP The kernel does not support sync object eventfds
+ */
+int funnel_buffer_get_acquire_eventfd(struct funnel_buffer *buf, int *pfd);
+
 /**
  * Set the sync file for releasing the buffer.
  *
  * This sync file must be signaled when access to the buffer is complete.
+ * It replaces any sync files previously set or added for this frame.
  *
  * @sync-ext
  *
@@ -135,3 +178,23 @@ int funnel_buffer_get_acquire_sync_file(struct funnel_buffer *buf, int *pfd);
  *  * Sync object APIs were already already used
  */
 int funnel_buffer_set_release_sync_file(struct funnel_buffer *buf, int fd);
+
+/**
+ * Add a sync file for releasing the buffer.
+ *
+ * This can be called multiple times per frame, for example when the
+ * buffer is written from several queues. All the sync files are merged,
+ * and the buffer is released once all of them are signaled. A later call
+ * to funnel_buffer_set_release_sync_file() replaces all of them.
+ *
+ * @sync-ext
+ *
+ * @param buf Buffer @borrowed
+ * @param fd DRM sync file signaled on release @borrowed
+ * @return_err
+ * @retval -EINVAL
+ *  * Invalid argument
+ *  * Buffer does not require sync
+ *  * Sync object APIs were already already used
+ */
+int funnel_buffer_add_release_sync_file(struct funnel_buffer *buf, int fd);
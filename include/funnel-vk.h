@@ -158,6 +158,7 @@ int funnel_buffer_get_vk_format(struct funnel_buffer *buf, VkFormat *pformat,
  * @retval -EINVAL
  *  * Invalid argument
  *  * API is not Vulkan
+ *  * Buffer uses timeline semaphores
  * @retval -EBUSY Already called once for this buffer
  * @retval -EIO Failed to import acquire semaphore into Vulkan
  */
@@ -165,6 +166,62 @@ int funnel_buffer_get_vk_semaphores(struct funnel_buffer *buf,
                                     VkSemaphore *pacquire,
                                     VkSemaphore *prelease);
 
+/**
+ * Import the buffer sync objects into Vulkan as timeline semaphores.
+ *
+ * When enabled, buffers allocated afterwards use timeline semaphores that
+ * share the DRM sync object timelines directly, instead of converting
+ * every acquire and release point through a sync file. Use
+ * funnel_buffer_get_vk_timeline_semaphores() instead of
+ * funnel_buffer_get_vk_semaphores() for such buffers.
+ *
+ * This requires the `timelineSemaphore` feature to be enabled on the
+ * VkDevice, and a driver whose opaque semaphore fds are DRM sync objects
+ * (this is the case for Mesa drivers). Buffers for which the import fails
+ * fall back to sync files.
+ *
+ * @sync-ext
+ *
+ * @param stream Stream @borrowed
+ * @param enable Whether to use timeline semaphores
+ * @return_err
+ * @retval -EINVAL
+ *  * Invalid argument
+ *  * API is not Vulkan
+ * @retval -ENOTSUP Timeline semaphore import is not supported
+ */
+int funnel_stream_vk_set_timeline_semaphores(struct funnel_stream *stream,
+                                             bool enable);
+
+/**
+ * Get the timeline VkSemaphores and points for acquiring and releasing the
+ * buffer.
+ *
+ * The user must wait on the acquire semaphore for the acquire point before
+ * accessing the buffer, and signal the release semaphore with the release
+ * point after accessing the buffer (using VkTimelineSemaphoreSubmitInfo).
+ * The semaphores are valid until the buffer is freed.
+ *
+ * @sync-ext
+ *
+ * @param buf Buffer @borrowed
+ * @param[out] pacquire Acquire timeline VkSemaphore @borrowed-from{buf}
+ * @param[out] pacquire_point Acquire timeline point
+ * @param[out] prelease Release timeline VkSemaphore @borrowed-from{buf}
+ * @param[out] prelease_point Release timeline point
+ * @return_err
+ * @retval -EINVAL
+ *  * Invalid argument
+ *  * API is not Vulkan
+ *  * Buffer does not use timeline semaphores
+ * @retval -EBUSY Already called once for this buffer
+ */
+int funnel_buffer_get_vk_timeline_semaphores(struct funnel_buffer *buf,
+                                             VkSemaphore *pacquire,
+                                             uint64_t *pacquire_point,
+                                             VkSemaphore *prelease,
+                                             uint64_t *prelease_point);
+
 /**
  * Get the VkFence that must be signaled by the queue batch
  *
@@ -34,6 +34,52 @@ static inline struct funnel_fraction FUNNEL_FRACTION(uint32_t num,
     return (struct funnel_fraction){num, den};
 }
 
+/**
+ * Statistics counters for a stream
+ */
+struct funnel_stream_stats {
+    /**
+     * Number of frames sent to the consumer
+     */
+    uint64_t frames_sent;
+    /**
+     * Number of sync-related ioctls issued for buffer synchronization
+     */
+    uint64_t sync_ioctls;
+    /**
+     * Number of sync-related ioctls avoided because a buffer was idle
+     */
+    uint64_t sync_ioctls_skipped;
+    /**
+     * Number of driver timer wakeups (only when the stream drives the graph)
+     */
+    uint64_t timer_wakeups;
+    /**
+     * Number of driver cycles skipped because the timer woke up too late
+     */
+    uint64_t timer_cycles_missed;
+    /**
+     * Sum of driver timer wakeup latencies past the deadline, in nanoseconds
+     */
+    uint64_t timer_late_ns_total;
+    /**
+     * Largest driver timer wakeup latency past the deadline, in nanoseconds
+     */
+    uint64_t timer_late_ns_max;
+    /**
+     * Number of times the FUNNEL_FIFO queue ran dry
+     */
+    uint64_t fifo_underruns;
+    /**
+     * Number of FUNNEL_SYNCHRONOUS cycles that missed their deadline
+     */
+    uint64_t sync_deadline_misses;
+    /**
+     * Number of stalled FUNNEL_SYNCHRONOUS cycles broken by the watchdog
+     */
+    uint64_t watchdog_stalls;
+};
+
 /** A user callback for buffer creation/destruction
  *
  * @param opaque Opaque user data pointer
@@ -44,6 +90,15 @@ typedef void (*funnel_buffer_callback)(void *opaque,
                                        struct funnel_stream *stream,
                                        struct funnel_buffer *buf);
 
+/** A user callback for frame rate changes
+ *
+ * @param opaque Opaque user data pointer
+ * @param stream Stream whose frame rate changed @borrowed
+ * @param rate Newly negotiated frame rate (FUNNEL_RATE_VARIABLE if variable)
+ */
+typedef void (*funnel_rate_callback)(void *opaque, struct funnel_stream *stream,
+                                     struct funnel_fraction rate);
+
 /**
  * Synchronization modes for the frame pacing
  */
@@ -119,6 +174,28 @@ enum funnel_mode {
      * is dequeued. It adds no latency.
      */
     FUNNEL_SYNCHRONOUS,
+    /**
+     * Produce frames into a queue that is drained at the
+     * frame rate.
+     *
+     * In this mode, submitted frames are queued in order,
+     * and one frame is sent out to the consumer in each
+     * PipeWire process cycle. No frames are dropped:
+     * libfunnel will block at `funnel_stream_enqueue()`
+     * while the queue is full (see
+     * `funnel_stream_set_fifo_depth()`).
+     *
+     * This is useful for producers with uneven frame times,
+     * such as video decoders or network sources. After the
+     * queue runs dry, sending only resumes once enough
+     * frames are queued to cover the jitter observed in the
+     * submission times, so the consumer sees a smooth
+     * cadence.
+     *
+     * This mode adds up to the queue depth in frames of
+     * latency.
+     */
+    FUNNEL_FIFO,
 };
 
 /**
@@ -207,6 +284,53 @@ void funnel_stream_set_buffer_callbacks(struct funnel_stream *stream,
 int funnel_stream_set_size(struct funnel_stream *stream, uint32_t width,
                            uint32_t height);
 
+/**
+ * Allow the consumer to negotiate the frame dimensions for a stream.
+ *
+ * By default, streams only advertise the fixed size configured with
+ * funnel_stream_set_size(). If a size range is set, the size configured with
+ * funnel_stream_set_size() becomes the preferred (default) size, and the
+ * consumer may pick any size within the range. Use funnel_buffer_get_size()
+ * to find out the negotiated size of each buffer, and render at that size.
+ *
+ * Pass zero for all arguments to go back to a fixed size.
+ *
+ * @sync-ext
+ *
+ * @param stream Stream @borrowed
+ * @param min_width Minimum width in pixels
+ * @param min_height Minimum height in pixels
+ * @param max_width Maximum width in pixels
+ * @param max_height Maximum height in pixels
+ * @return_err
+ * @retval -EINVAL Invalid argument
+ */
+int funnel_stream_set_size_range(struct funnel_stream *stream,
+                                 uint32_t min_width, uint32_t min_height,
+                                 uint32_t max_width, uint32_t max_height);
+
+/**
+ * Prefer formats without an alpha channel when the consumer accepts them.
+ *
+ * By default, formats are offered to the consumer in the order they were
+ * added, so if both formats with and without alpha were added, the first
+ * one the consumer accepts wins. If the application does not need alpha
+ * (for example, because it only renders opaque content), enabling this
+ * makes libfunnel pick a format without alpha whenever the consumer also
+ * supports one, and only fall back to alpha formats otherwise. Some drivers
+ * use cheaper compression for opaque formats.
+ *
+ * Use the API-specific format query (for example,
+ * funnel_buffer_get_egl_format()) to find out which variant was picked.
+ *
+ * @sync-ext
+ *
+ * @param stream Stream @borrowed
+ * @param prefer_opaque Whether to prefer formats without alpha
+ */
+void funnel_stream_set_prefer_opaque(struct funnel_stream *stream,
+                                     bool prefer_opaque);
+
 /**
  * Configure the queueing mode for the stream.
  *
@@ -219,6 +343,113 @@ int funnel_stream_set_size(struct funnel_stream *stream, uint32_t width,
  */
 int funnel_stream_set_mode(struct funnel_stream *stream, enum funnel_mode mode);
 
+/**
+ * Set the maximum number of queued frames in FUNNEL_FIFO mode.
+ *
+ * The default is 3. The number of frames accumulated before sending starts
+ * adapts to the observed jitter, up to this depth.
+ *
+ * @sync-ext
+ *
+ * @param stream Stream @borrowed
+ * @param depth Maximum number of queued frames (1 to 16)
+ * @return_err
+ * @retval -EINVAL Invalid argument
+ */
+int funnel_stream_set_fifo_depth(struct funnel_stream *stream, uint32_t depth);
+
+/**
+ * Set the driver priority of the stream node.
+ *
+ * libfunnel streams can drive the PipeWire graph, and PipeWire picks the
+ * driver with the highest priority among the linked nodes. By default, the
+ * priority is 1 in FUNNEL_ASYNC mode, so that any real driver (such as a
+ * consumer's own driver) wins, and unset in the other modes, where the
+ * stream only drives when no other driver is present. A higher priority
+ * makes the stream win the driver election, so that the graph follows the
+ * stream's frame timing.
+ *
+ * @sync-ext
+ *
+ * @param stream Stream @borrowed
+ * @param priority Driver priority, or -1 for the default of the mode
+ * @return_err
+ * @retval -EINVAL Invalid argument
+ */
+int funnel_stream_set_driver_priority(struct funnel_stream *stream,
+                                      int priority);
+
+/**
+ * Set the requested latency of the stream node.
+ *
+ * This sets the `node.latency` property, which requests a graph quantum of
+ * `latency.num` samples at a rate of `latency.den`. When several nodes
+ * request a latency, the graph uses the lowest one. Requesting one frame at
+ * the frame rate (for example, 1/60) keeps the quantum from adding latency
+ * beyond a single frame.
+ *
+ * This is most useful in FUNNEL_SYNCHRONOUS and FUNNEL_SINGLE_BUFFERED
+ * modes, which aim for low latency. In FUNNEL_FIFO mode, latency is
+ * dominated by the queue depth instead.
+ *
+ * @sync-ext
+ *
+ * @param stream Stream @borrowed
+ * @param latency Requested latency, or 0/0 to unset
+ * @return_err
+ * @retval -EINVAL Invalid argument
+ */
+int funnel_stream_set_latency(struct funnel_stream *stream,
+                              struct funnel_fraction latency);
+
+/**
+ * Force the graph rate while the stream is active.
+ *
+ * This sets the `node.force-rate` property. It is rarely needed for video
+ * streams, and only takes effect when the stream is part of a graph whose
+ * rate can be changed.
+ *
+ * @sync-ext
+ *
+ * @param stream Stream @borrowed
+ * @param rate Graph rate to force, or 0 to unset
+ */
+void funnel_stream_set_force_rate(struct funnel_stream *stream, uint32_t rate);
+
+/**
+ * Set the node group of the stream.
+ *
+ * Nodes in the same group (the `node.group` property) are always scheduled
+ * by the same driver. This can be used to tie several streams, or a stream
+ * and an audio node, to the same clock, so they stay in sync.
+ *
+ * @sync-ext
+ *
+ * @param stream Stream @borrowed
+ * @param group Group name (up to 63 bytes), or NULL to unset
+ * @return_err
+ * @retval -EINVAL Group name is too long
+ */
+int funnel_stream_set_group(struct funnel_stream *stream, const char *group);
+
+/**
+ * Process the stream node even when it has no links.
+ *
+ * This sets the `node.always-process` property, which keeps the stream
+ * taking part in graph cycles while no consumer is connected, instead of
+ * being suspended. Frames submitted in that state are discarded, so this is
+ * mainly useful to keep the stream's frame timing (and, in
+ * FUNNEL_SYNCHRONOUS mode, the cadence of funnel_stream_dequeue()) stable
+ * across consumer reconnections.
+ *
+ * @sync-ext
+ *
+ * @param stream Stream @borrowed
+ * @param always_process Whether to always process the node
+ */
+void funnel_stream_set_always_process(struct funnel_stream *stream,
+                                      bool always_process);
+
 /**
  * Configure the synchronization modes for the stream.
  *
@@ -267,6 +498,149 @@ int funnel_stream_set_rate(struct funnel_stream *stream,
 int funnel_stream_get_rate(struct funnel_stream *stream,
                            struct funnel_fraction *prate);
 
+/**
+ * Specify a callback for frame rate changes.
+ *
+ * The callback is called whenever the consumer (re)negotiates the frame rate
+ * of the stream, once the new format has been accepted. It is called from
+ * the libfunnel PipeWire thread with the PipeWire loop lock held, so it must
+ * not block, and must not call funnel_stream_dequeue() or
+ * funnel_stream_enqueue().
+ *
+ * @sync-ext
+ *
+ * @param stream Stream @borrowed
+ * @param cb Callback when the frame rate changes @borrowed-by{stream}
+ * @param opaque Opaque user pointer
+ */
+void funnel_stream_set_rate_callback(struct funnel_stream *stream,
+                                     funnel_rate_callback cb, void *opaque);
+
+/**
+ * Compute how many frames to skip between frames sent to a stream.
+ *
+ * This is useful in FUNNEL_ASYNC mode, when the application renders at its
+ * own rate (for example, the display refresh rate) and the consumer
+ * negotiated a lower frame rate. Sending one frame, then skipping `*pskip`
+ * frames (without dequeueing a buffer) keeps the sent frame rate at or
+ * above the negotiated rate, without rendering frames nobody will see.
+ *
+ * @sync-int
+ *
+ * @param stream Stream @borrowed
+ * @param render_rate Frame rate the application renders at
+ * @param[out] pskip Number of frames to skip after each sent frame
+ * @return_err
+ * @retval -EINVAL Invalid argument
+ * @retval -EINPROGRESS The stream is not yet initialized
+ */
+int funnel_stream_get_frame_skip(struct funnel_stream *stream,
+                                 struct funnel_fraction render_rate,
+                                 uint32_t *pskip);
+
+/**
+ * Suspend the driver clock of a stream when it is idle.
+ *
+ * When libfunnel drives the PipeWire graph, the driver timer fires at the
+ * negotiated frame rate even if the application is not producing frames.
+ * With an idle timeout set, the timer is stopped after `cycles` consecutive
+ * graph cycles without a new frame, and restarted on the next
+ * funnel_stream_dequeue() or funnel_stream_enqueue(). The first cycle is due
+ * immediately, or in phase with the reference set with
+ * funnel_stream_set_clock_reference() if there is one.
+ *
+ * The default is 0, which never suspends the driver clock.
+ *
+ * @sync-int
+ *
+ * @param stream Stream @borrowed
+ * @param cycles Number of idle cycles before suspending, or 0 to disable
+ */
+void funnel_stream_set_idle_timeout(struct funnel_stream *stream,
+                                    uint32_t cycles);
+
+/**
+ * Set a per-cycle deadline for FUNNEL_SYNCHRONOUS mode.
+ *
+ * In FUNNEL_SYNCHRONOUS mode, the PipeWire graph is blocked from the start
+ * of a process cycle until the frame is submitted, so one slow frame stalls
+ * every node in the graph. With a deadline set, if no frame was submitted
+ * within `budget_ns` of the start of the cycle, the cycle continues without
+ * a frame. The late frame is sent in the next cycle once it is enqueued.
+ *
+ * The default is 0, which waits for the frame indefinitely.
+ *
+ * @sync-int
+ *
+ * @param stream Stream @borrowed
+ * @param budget_ns Time budget per cycle in nanoseconds, or 0 to disable
+ */
+void funnel_stream_set_sync_deadline(struct funnel_stream *stream,
+                                     uint64_t budget_ns);
+
+/**
+ * Set a watchdog for stalled cycles in FUNNEL_SYNCHRONOUS mode.
+ *
+ * If a process cycle is held for longer than `timeout_ns` because the
+ * dequeued buffer was not submitted (for example, if the application hung),
+ * the watchdog logs a warning with the call stack of the last
+ * funnel_stream_dequeue() call (where supported), and lets the PipeWire
+ * graph continue. The late frame is sent in the next cycle once it is
+ * enqueued.
+ *
+ * This is meant to catch hangs, and is only used when no deadline was set
+ * with funnel_stream_set_sync_deadline(). The default is 0, which disables
+ * the watchdog.
+ *
+ * @sync-int
+ *
+ * @param stream Stream @borrowed
+ * @param timeout_ns Stall threshold in nanoseconds, or 0 to disable
+ */
+void funnel_stream_set_watchdog(struct funnel_stream *stream,
+                                uint64_t timeout_ns);
+
+/**
+ * Feed an externally observed timestamp to the driver clock of a stream.
+ *
+ * When libfunnel drives the PipeWire graph (FUNNEL_DOUBLE_BUFFERED,
+ * FUNNEL_SINGLE_BUFFERED and FUNNEL_SYNCHRONOUS modes), graph cycles are
+ * scheduled from an internal timer at the negotiated frame rate. If the
+ * application renders at another clock, such as the display refresh rate,
+ * the two clocks beat against each other and frames get duplicated or
+ * dropped.
+ *
+ * Calling this function with each presentation or vblank timestamp
+ * phase-locks the driver timer to the reference, so that each rendered frame
+ * maps to one graph cycle when the rates match. The reference is also used to
+ * pick the initial phase when the stream starts driving.
+ *
+ * This has no effect in FUNNEL_ASYNC mode, where each enqueued frame
+ * triggers its own graph cycle.
+ *
+ * @sync-int
+ *
+ * @param stream Stream @borrowed
+ * @param time_ns Reference timestamp in CLOCK_MONOTONIC nanoseconds
+ * @return_err
+ * @retval -EINVAL Invalid argument
+ */
+int funnel_stream_set_clock_reference(struct funnel_stream *stream,
+                                      uint64_t time_ns);
+
+/**
+ * Get the statistics counters of a stream.
+ *
+ * The counters are cumulative over the lifetime of the stream.
+ *
+ * @sync-int
+ *
+ * @param stream Stream @borrowed
+ * @param[out] pstats Statistics counters
+ */
+void funnel_stream_get_stats(struct funnel_stream *stream,
+                             struct funnel_stream_stats *pstats);
+
 /**
  * Clear the supported format list. Used for reconfiguration.
  *
@@ -376,6 +750,31 @@ int funnel_stream_dequeue(struct funnel_stream *stream,
 int funnel_stream_enqueue(struct funnel_stream *stream,
                           struct funnel_buffer *buf);
 
+/**
+ * Enqueue a buffer to a stream, to be sent at a target presentation time.
+ *
+ * This works like funnel_stream_enqueue(), but the frame is held until the
+ * process cycle closest to `target_ns` instead of being sent in the next
+ * one. Unless a timestamp was set with funnel_buffer_set_timestamp(), the
+ * target time is also used as the presentation timestamp of the frame.
+ *
+ * Only one frame can be pending at a time: in FUNNEL_ASYNC mode, a later
+ * enqueue replaces a held frame, and in the other modes it waits for the
+ * held frame to be sent. In FUNNEL_SYNCHRONOUS mode, frames are always sent
+ * in the current cycle.
+ *
+ * @sync-int
+ *
+ * @param stream Stream @borrowed
+ * @param buf Buffer to enqueue @owned
+ * @param target_ns Target presentation time in CLOCK_MONOTONIC nanoseconds,
+ * or 0 to send the frame in the next cycle
+ * @return Whether a buffer was enqueued successfully, or a negative error
+ * number on error, as for funnel_stream_enqueue().
+ */
+int funnel_stream_enqueue_at(struct funnel_stream *stream,
+                             struct funnel_buffer *buf, uint64_t target_ns);
+
 /**
  * Return a buffer to the pool without enqueueing it.
  *
@@ -396,6 +795,28 @@ int funnel_stream_enqueue(struct funnel_stream *stream,
 int funnel_stream_return(struct funnel_stream *stream,
                          struct funnel_buffer *buf);
 
+/**
+ * Send the most recently sent frame again.
+ *
+ * This is useful when the contents did not change since the last frame
+ * (for example, for static UIs or slideshows): instead of rendering and
+ * enqueueing a new frame, the buffer that was last sent is queued again in
+ * the next process cycle, without any dequeue, synchronization or GPU
+ * work. The consumer keeps receiving frames at a steady rate.
+ *
+ * The buffer can only be sent again once the consumer has released it. If it
+ * is still in use, nothing is sent in that cycle. A frame enqueued before
+ * the next cycle takes precedence over the repeat.
+ *
+ * @sync-int
+ *
+ * @param stream Stream @borrowed
+ * @return_err
+ * @retval -EINVAL Stream is in an invalid state (not yet configured)
+ * @retval -ENOENT No frame was sent yet
+ */
+int funnel_stream_repeat_frame(struct funnel_stream *stream);
+
 /**
  * Skip a frame for a stream
  *
@@ -414,6 +835,10 @@ int funnel_stream_skip_frame(struct funnel_stream *stream);
 /**
  * Get the dimensions of a Funnel buffer.
  *
+ * If a size range was configured with funnel_stream_set_size_range(), this
+ * is the size negotiated with the consumer, which may differ from the size
+ * passed to funnel_stream_set_size().
+ *
  * @sync-ext
  *
  * @param buf Buffer @borrowed
@@ -449,6 +874,35 @@ void funnel_buffer_set_user_data(struct funnel_buffer *buf, void *opaque);
  */
 void *funnel_buffer_get_user_data(struct funnel_buffer *buf);
 
+/**
+ * Set the presentation timestamp of a frame.
+ *
+ * The timestamp is sent to the consumer in the buffer header metadata, and
+ * should be the time the frame was captured or rendered for, so that the
+ * consumer can synchronize it with other media. If no timestamp is set
+ * between funnel_stream_dequeue() and funnel_stream_enqueue(), the time of
+ * the enqueue call is used.
+ *
+ * @sync-ext
+ *
+ * @param buf Buffer @borrowed
+ * @param pts_ns Presentation timestamp in CLOCK_MONOTONIC nanoseconds
+ */
+void funnel_buffer_set_timestamp(struct funnel_buffer *buf, int64_t pts_ns);
+
+/**
+ * Mark the contents of a frame as corrupted.
+ *
+ * The frame is still sent, but the consumer is told that its contents are
+ * not valid (for example, if rendering failed partway through). The mark
+ * is cleared when the buffer is dequeued again.
+ *
+ * @sync-ext
+ *
+ * @param buf Buffer @borrowed
+ */
+void funnel_buffer_mark_corrupted(struct funnel_buffer *buf);
+
 /**
  * Check whether a buffer requires explicit synchronization.
  *
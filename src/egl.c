@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 
 PW_LOG_TOPIC_STATIC(log_funnel_egl, "funnel.egl");
@@ -274,8 +275,8 @@ int funnel_buffer_get_acquire_egl_sync(struct funnel_buffer *buf,
                           attributes);
     if (*sync == EGL_NO_SYNC) {
         pw_log_error("Unable to create an acquire EGLSync");
-        return -EIO;
         close(fd);
+        return -EIO;
     }
 
     return 0;
@@ -298,3 +299,61 @@ int funnel_buffer_set_release_egl_sync(struct funnel_buffer *buf,
     close(fd);
     return ret;
 }
+
+int funnel_buffer_wait_acquire_egl_sync(struct funnel_buffer *buf) {
+    int fd;
+
+    if (!buf || buf->stream->api != API_EGL)
+        return -EINVAL;
+
+    int ret = funnel_buffer_get_acquire_sync_file(buf, &fd);
+    if (ret < 0)
+        return ret;
+
+    // Usually, the consumer is long done with the buffer by the time it is
+    // dequeued again, so skip creating an EGLSync if there is nothing to
+    // wait for.
+    struct pollfd pfd = {
+        .fd = fd,
+        .events = POLLIN,
+    };
+    if (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN)) {
+        close(fd);
+        return 0;
+    }
+
+    EGLAttrib attributes[] = {EGL_SYNC_NATIVE_FENCE_FD_ANDROID, fd, EGL_NONE};
+
+    EGLDisplay display = buf->stream->api_ctx;
+    EGLSync sync =
+        eglCreateSync(display, EGL_SYNC_NATIVE_FENCE_ANDROID, attributes);
+    if (sync == EGL_NO_SYNC) {
+        pw_log_error("Unable to create an acquire EGLSync");
+        close(fd);
+        return -EIO;
+    }
+
+    // The EGLSync owns the fd now
+    ret = eglWaitSync(display, sync, 0) ? 0 : -EIO;
+    if (ret < 0)
+        pw_log_error("Unable to wait on the acquire EGLSync");
+
+    eglDestroySync(display, sync);
+    return ret;
+}
+
+int funnel_buffer_signal_release_egl_sync(struct funnel_buffer *buf) {
+    if (!buf || buf->stream->api != API_EGL)
+        return -EINVAL;
+
+    EGLDisplay display = buf->stream->api_ctx;
+    EGLSync sync = eglCreateSync(display, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+    if (sync == EGL_NO_SYNC) {
+        pw_log_error("Unable to create a release EGLSync");
+        return -EIO;
+    }
+
+    int ret = funnel_buffer_set_release_egl_sync(buf, sync);
+    eglDestroySync(display, sync);
+    return ret;
+}
@@ -7,11 +7,16 @@
 #include <asm-generic/errno.h>
 #include <assert.h>
 #include <errno.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
 #include <fcntl.h>
 #include <libdrm/drm_fourcc.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/eventfd.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -23,9 +28,11 @@
 #include <spa/pod/dynamic.h>
 #include <spa/pod/filter.h>
 #include <spa/utils/result.h>
+#include <spa/utils/string.h>
 
 #include <gbm.h>
 #include <linux/dma-buf.h>
+#include <linux/sync_file.h>
 #include <pipewire/log.h>
 #include <pipewire/pipewire.h>
 #include <pipewire/stream.h>
@@ -37,22 +44,27 @@ PW_LOG_TOPIC_STATIC(log_funnel, "funnel.core");
 static struct {
     uint32_t drm_format;
     enum spa_video_format spa_format;
+    bool alpha;
 } supported_formats[] = {
     {
         .drm_format = GBM_FORMAT_ARGB8888,
         .spa_format = SPA_VIDEO_FORMAT_BGRA,
+        .alpha = true,
     },
     {
         .drm_format = GBM_FORMAT_RGBA8888,
         .spa_format = SPA_VIDEO_FORMAT_ABGR,
+        .alpha = true,
     },
     {
         .drm_format = GBM_FORMAT_ABGR8888,
         .spa_format = SPA_VIDEO_FORMAT_RGBA,
+        .alpha = true,
     },
     {
         .drm_format = GBM_FORMAT_BGRA8888,
         .spa_format = SPA_VIDEO_FORMAT_ARGB,
+        .alpha = true,
     },
     {
         .drm_format = GBM_FORMAT_XRGB8888,
@@ -89,6 +101,152 @@ static void free_params(const struct spa_pod **params, size_t count) {
 static int build_formats(struct funnel_stream *stream, bool fixate,
                          const struct spa_pod **params);
 
+static bool format_has_alpha(uint32_t drm_format) {
+    for (int i = 0; i < ARRAY_SIZE(supported_formats); i++) {
+        if (supported_formats[i].drm_format == drm_format)
+            return supported_formats[i].alpha;
+    }
+    return false;
+}
+
+static bool is_modifier_blacklisted(struct funnel_ctx *ctx, uint32_t format,
+                                    uint64_t modifier) {
+    struct funnel_bad_modifier *bad;
+
+    pw_array_for_each (bad, &ctx->bad_modifiers) {
+        if (bad->format == format && bad->modifier == modifier)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Remove blacklisted modifiers from a list in place. LINEAR is never
+ * blacklisted, and is moved to the end of the list so that it is only picked
+ * as the last resort. If every modifier is blacklisted, the list is left
+ * unfiltered: the other end (or the API) may not support anything else, so a
+ * blacklisted modifier is better than nothing.
+ */
+static size_t filter_modifiers(struct funnel_ctx *ctx, uint32_t format,
+                               uint64_t *modifiers, size_t num_modifiers) {
+    size_t count = 0;
+    bool linear = false;
+
+    for (size_t i = 0; i < num_modifiers; i++) {
+        if (!is_modifier_blacklisted(ctx, format, modifiers[i]))
+            count++;
+    }
+
+    if (!count) {
+        pw_log_debug("All modifiers for format 0x%x are blacklisted, "
+                     "keeping them",
+                     format);
+        return num_modifiers;
+    }
+
+    count = 0;
+    for (size_t i = 0; i < num_modifiers; i++) {
+        if (modifiers[i] == DRM_FORMAT_MOD_LINEAR)
+            linear = true;
+        else if (!is_modifier_blacklisted(ctx, format, modifiers[i]))
+            modifiers[count++] = modifiers[i];
+    }
+
+    if (linear)
+        modifiers[count++] = DRM_FORMAT_MOD_LINEAR;
+
+    return count;
+}
+
+/*
+ * Re-advertise all formats (without the fixated one), forcing buffers to be
+ * re-created even if the consumer picks the same format and size again.
+ */
+static void renegotiate_formats(struct funnel_stream *stream) {
+    size_t num_formats =
+        pw_array_get_len(&stream->cur.config.formats, struct funnel_format);
+
+    const struct spa_pod **params =
+        calloc(num_formats, sizeof(struct spa_pod *));
+
+    int num_params = build_formats(stream, false, params);
+    assert(num_params <= num_formats);
+
+    stream->cur.format = 0;
+    stream->cur.ready = false;
+    pw_stream_update_params(stream->stream, params, num_params);
+    free_params(params, num_params);
+    free(params);
+}
+
+/*
+ * Reconnect a stream that went into the error state. A stream in that state
+ * ignores new params, so this is the only way to renegotiate its formats.
+ * Runs from the loop rather than from the stream event that reported the
+ * error, since the stream cannot be disconnected from within its own events.
+ */
+static void on_reconnect(void *data, uint64_t count) {
+    struct funnel_stream *stream = data;
+
+    if (!stream->stream)
+        return;
+
+    size_t num_formats =
+        pw_array_get_len(&stream->cur.config.formats, struct funnel_format);
+
+    const struct spa_pod **params =
+        calloc(num_formats, sizeof(struct spa_pod *));
+
+    int num_params = build_formats(stream, false, params);
+    assert(num_params <= num_formats);
+
+    pw_log_info("Reconnecting stream %s", stream->name);
+
+    stream->cur.format = 0;
+    stream->cur.ready = false;
+    pw_stream_disconnect(stream->stream);
+    if (pw_stream_connect(stream->stream, PW_DIRECTION_OUTPUT, SPA_ID_INVALID,
+                          PW_STREAM_FLAG_ALLOC_BUFFERS | PW_STREAM_FLAG_DRIVER,
+                          params, num_params) != 0)
+        pw_log_error("failed to reconnect stream %s", stream->name);
+
+    free_params(params, num_params);
+    free(params);
+}
+
+/*
+ * Called when the consumer appears to have failed to import our buffers.
+ * Blacklists the current format/modifier for the lifetime of the context
+ * and renegotiates without it, reconnecting the stream first if it is in the
+ * error state.
+ */
+static void handle_import_failure(struct funnel_stream *stream) {
+    struct funnel_ctx *ctx = stream->ctx;
+
+    if (!stream->cur.format || stream->cur.modifier == DRM_FORMAT_MOD_LINEAR ||
+        stream->cur.modifier == DRM_FORMAT_MOD_INVALID)
+        return;
+
+    if (is_modifier_blacklisted(ctx, stream->cur.format, stream->cur.modifier))
+        return;
+
+    pw_log_warn("Consumer failed to import format 0x%x modifier 0x%llx, "
+                "renegotiating without it",
+                stream->cur.format, (long long)stream->cur.modifier);
+
+    struct funnel_bad_modifier *bad =
+        pw_array_add(&ctx->bad_modifiers, sizeof(struct funnel_bad_modifier));
+    assert(bad);
+    bad->format = stream->cur.format;
+    bad->modifier = stream->cur.modifier;
+
+    if (pw_stream_get_state(stream->stream, NULL) == PW_STREAM_STATE_ERROR)
+        pw_loop_signal_event(pw_thread_loop_get_loop(ctx->loop),
+                             stream->reconnect);
+    else
+        renegotiate_formats(stream);
+}
+
 static void on_core_error(void *data, uint32_t id, int seq, int res,
                           const char *message) {
     struct funnel_ctx *ctx = data;
@@ -114,6 +272,10 @@ static void on_add_buffer(void *data, struct pw_buffer *pwbuffer) {
     stl = spa_buffer_find_meta_data(spa_buffer, SPA_META_SyncTimeline,
                                     sizeof(*stl));
 
+    struct spa_meta_header *header;
+    header = spa_buffer_find_meta_data(spa_buffer, SPA_META_Header,
+                                       sizeof(*header));
+
     struct spa_data *spa_data = pwbuffer->buffer->datas;
     assert(spa_data[0].type & (1 << SPA_DATA_DmaBuf));
 
@@ -130,21 +292,24 @@ static void on_add_buffer(void *data, struct pw_buffer *pwbuffer) {
     buffer->pw_buffer = pwbuffer;
     buffer->stream = stream;
     buffer->bo = bo;
+    buffer->header = header;
     buffer->width = stream->cur.width;
     buffer->height = stream->cur.height;
 
     buffer->backend_sync = !!stl;
+    // A frontend supporting both uses explicit sync whenever the backend
+    // does. Only an implicit-only frontend on an explicit backend has
+    // libfunnel convert between dma-buf fences and sync timelines itself.
     buffer->frontend_sync =
-        buffer->backend_sync ||
-        stream->cur.config.frontend_sync == FUNNEL_SYNC_EXPLICIT;
+        stream->cur.config.frontend_sync == FUNNEL_SYNC_EXPLICIT ||
+        (stream->cur.config.frontend_sync == FUNNEL_SYNC_BOTH &&
+         buffer->backend_sync);
 
-    // TODO: Implement
-    // https://gitlab.freedesktop.org/pipewire/pipewire/-/issues/4885
+    // Set once the consumer is seen scheduling release points, see
+    // buffer_check_release_point().
     buffer->backend_sync_reliable = false;
 
-    assert(buffer->frontend_sync || !buffer->backend_sync);
-
-    if (buffer->frontend_sync) {
+    if (buffer->frontend_sync || buffer->backend_sync) {
         int fd = gbm_device_get_fd(stream->gbm);
 
         int ret = drmSyncobjCreate(fd, 0, &buffer->acquire.handle);
@@ -162,6 +327,7 @@ static void on_add_buffer(void *data, struct pw_buffer *pwbuffer) {
     for (int i = 0; i < ARRAY_SIZE(buffer->fds); i++) {
         buffer->fds[i] = -1;
     }
+    buffer->pending_release_fd = -1;
 
     pwbuffer->user_data = buffer;
 
@@ -233,8 +399,10 @@ static void funnel_buffer_free(struct funnel_buffer *buffer) {
         if (buffer->fds[i] >= 0)
             close(buffer->fds[i]);
     }
+    if (buffer->pending_release_fd >= 0)
+        close(buffer->pending_release_fd);
 
-    if (buffer->frontend_sync) {
+    if (buffer->frontend_sync || buffer->backend_sync) {
         int fd = gbm_device_get_fd(stream->gbm);
 
         int ret = drmSyncobjDestroy(fd, buffer->acquire.handle);
@@ -246,6 +414,29 @@ static void funnel_buffer_free(struct funnel_buffer *buffer) {
     free(buffer);
 }
 
+static inline void count_sync_ioctls(struct funnel_stream *stream,
+                                     uint64_t issued, uint64_t skipped) {
+    if (issued)
+        __atomic_fetch_add(&stream->stats.sync_ioctls, issued,
+                           __ATOMIC_RELAXED);
+    if (skipped)
+        __atomic_fetch_add(&stream->stats.sync_ioctls_skipped, skipped,
+                           __ATOMIC_RELAXED);
+}
+
+/// Number of ioctls needed to move a fence between a sync file and a
+/// timeline point
+static inline uint64_t sync_transfer_ioctls(struct funnel_stream *stream) {
+    return stream->gbm_timeline_sync_import_export ? 1 : 2;
+}
+
+static inline bool is_buffer_idle(struct funnel_stream *stream,
+                                  struct funnel_buffer *buf) {
+    if (!stream->funcs || !stream->funcs->buffer_is_idle)
+        return true;
+    return stream->funcs->buffer_is_idle(buf);
+}
+
 static inline bool is_buffer_pending(struct funnel_stream *stream) {
     assert(!(stream->pending_buffer && stream->skip_buffer));
     return stream->pending_buffer || stream->skip_buffer;
@@ -258,6 +449,15 @@ static void on_remove_buffer(void *data, struct pw_buffer *pwbuffer) {
         struct funnel_buffer *buffer = pwbuffer->user_data;
         struct funnel_stream *stream = buffer->stream;
 
+        if (buffer->queued) {
+            spa_list_remove(&buffer->queue_link);
+            buffer->queued = false;
+            stream->fifo.len--;
+        }
+
+        if (buffer == stream->last_sent)
+            stream->last_sent = NULL;
+
         if (!buffer->dequeued) {
             funnel_buffer_free(buffer);
             if (buffer == stream->pending_buffer)
@@ -280,8 +480,124 @@ static void on_remove_buffer(void *data, struct pw_buffer *pwbuffer) {
     }
 }
 
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t clock_deadline(struct funnel_stream *stream) {
+    uint64_t num = stream->clock.rate.num;
+
+    // cycle < rate.num (see clock_advance), so cycle * rate.denom fits in
+    // 64 bits, but multiplying that by 1e9 might not. Split it into whole
+    // and fractional periods of rate.num cycles, which keeps every product
+    // below 2^62 for any 32-bit rate.
+    uint64_t ticks = stream->clock.cycle * stream->clock.rate.denom;
+    return stream->clock.base_ns + ticks / num * 1000000000ULL +
+           ticks % num * 1000000000ULL / num;
+}
+
+static int64_t clock_period(struct funnel_stream *stream) {
+    return stream->clock.rate.denom * 1000000000LL / stream->clock.rate.num;
+}
+
+static int64_t clock_phase_error(struct funnel_stream *stream,
+                                 uint64_t time_ns) {
+    int64_t period = clock_period(stream);
+    int64_t error = (int64_t)(time_ns - clock_deadline(stream)) % period;
+
+    // Wrap into [-period/2, period/2)
+    if (error >= period / 2)
+        error -= period;
+    else if (error < -period / 2)
+        error += period;
+
+    return error;
+}
+
+static int64_t frame_period(struct funnel_stream *stream) {
+    if (stream->clock.active)
+        return clock_period(stream);
+
+    struct spa_fraction rate = stream->cur.video_format.framerate;
+    if (!rate.num || !rate.denom)
+        return 1000000000LL / 60;
+
+    return rate.denom * 1000000000LL / rate.num;
+}
+
+static void clock_advance(struct funnel_stream *stream, uint64_t cycles) {
+    stream->clock.cycle += cycles;
+    // Every rate.num cycles is exactly rate.denom seconds, so rebase there
+    // to keep the arithmetic exact and bounded.
+    stream->clock.base_ns += stream->clock.cycle / stream->clock.rate.num *
+                             stream->clock.rate.denom * 1000000000ULL;
+    stream->clock.cycle %= stream->clock.rate.num;
+}
+
+static void clock_arm(struct funnel_stream *stream) {
+    uint64_t deadline = clock_deadline(stream);
+    struct timespec timeout = {
+        .tv_sec = deadline / 1000000000ULL,
+        .tv_nsec = deadline % 1000000000ULL,
+    };
+
+    // Loop timers are CLOCK_MONOTONIC timerfds, so this is TFD_TIMER_ABSTIME
+    pw_loop_update_timer(pw_thread_loop_get_loop(stream->ctx->loop),
+                         stream->timer, &timeout, NULL, true);
+}
+
+/// Restart the clock with the first cycle due now, or at the next cycle of
+/// the external reference if there is one.
+static void clock_restart(struct funnel_stream *stream) {
+    stream->clock.base_ns = monotonic_ns();
+    stream->clock.cycle = 0;
+    if (stream->clock.ref_ns) {
+        // Start in phase with the external reference, no earlier than now
+        int64_t error = clock_phase_error(stream, stream->clock.ref_ns);
+        if (error < 0)
+            error += clock_period(stream);
+        stream->clock.base_ns += error;
+    }
+    clock_arm(stream);
+}
+
+static void clock_resume(struct funnel_stream *stream) {
+    stream->clock.idle_cycles = 0;
+
+    if (!stream->clock.active || !stream->clock.suspended)
+        return;
+
+    pw_log_debug("Resuming idle driver clock");
+    stream->clock.suspended = false;
+    clock_restart(stream);
+}
+
+/*
+ * Without our own driver clock nothing may trigger another cycle, so arm the
+ * stream timer to wake up for a frame held until its target time (see
+ * on_process()). Returns false if there is no such frame.
+ */
+static bool arm_hold_wakeup(struct funnel_stream *stream) {
+    struct funnel_buffer *buf = stream->pending_buffer;
+
+    if (!buf || !buf->target_ns ||
+        stream->cur.config.mode == FUNNEL_SYNCHRONOUS ||
+        !pw_stream_is_driving(stream->stream))
+        return false;
+
+    uint64_t wakeup = buf->target_ns - frame_period(stream) / 2;
+    struct timespec timeout = {
+        .tv_sec = wakeup / 1000000000ULL,
+        .tv_nsec = wakeup % 1000000000ULL,
+    };
+    pw_loop_update_timer(pw_thread_loop_get_loop(stream->ctx->loop),
+                         stream->timer, &timeout, NULL, true);
+    return true;
+}
+
 static void update_timeouts(struct funnel_stream *stream) {
-    struct timespec timeout, interval, *to, *iv;
     enum pw_stream_state state = pw_stream_get_state(stream->stream, NULL);
 
     bool timeouts_active = false;
@@ -293,29 +609,35 @@ static void update_timeouts(struct funnel_stream *stream) {
         timeouts_active = true;
 
     if (!timeouts_active) {
-        to = iv = NULL;
-    } else {
-        struct spa_fraction rate = stream->cur.video_format.framerate;
+        stream->clock.active = false;
+        stream->clock.suspended = false;
+        // Keep the wakeup for a held frame, if there is one
+        if (!arm_hold_wakeup(stream))
+            pw_loop_update_timer(pw_thread_loop_get_loop(stream->ctx->loop),
+                                 stream->timer, NULL, NULL, false);
+        return;
+    }
 
-        if (rate.num == 0 || rate.denom == 0) {
-            // Pick a default rate of 60 FPS
-            rate.num = 60;
-            rate.denom = 1;
-            pw_log_debug("default rate: 60 FPS");
-        } else {
-            pw_log_debug("negotiated rate: %d/%d FPS", rate.num, rate.denom);
-        }
-        uint64_t nsec = rate.denom * 1000000000L / rate.num;
+    struct spa_fraction rate = stream->cur.video_format.framerate;
 
-        timeout.tv_sec = 0;
-        timeout.tv_nsec = 1;
-        interval.tv_sec = nsec / 1000000000L;
-        interval.tv_nsec = nsec % 1000000000L;
-        to = &timeout;
-        iv = &interval;
+    if (rate.num == 0 || rate.denom == 0) {
+        // Pick a default rate of 60 FPS
+        rate.num = 60;
+        rate.denom = 1;
+        pw_log_debug("default rate: 60 FPS");
+    } else {
+        pw_log_debug("negotiated rate: %d/%d FPS", rate.num, rate.denom);
     }
-    pw_loop_update_timer(pw_thread_loop_get_loop(stream->ctx->loop),
-                         stream->timer, to, iv, false);
+
+    if (stream->clock.active && stream->clock.rate.num == rate.num &&
+        stream->clock.rate.denom == rate.denom)
+        return; // Keep the current phase
+
+    stream->clock.active = true;
+    stream->clock.rate = rate;
+    stream->clock.suspended = false;
+    stream->clock.idle_cycles = 0;
+    clock_restart(stream);
 }
 
 static int return_buffer(struct funnel_stream *stream,
@@ -328,12 +650,77 @@ static int return_buffer(struct funnel_stream *stream,
     return pw_stream_return_buffer(stream->stream, buf->pw_buffer);
 }
 
+static void fifo_flush(struct funnel_stream *stream) {
+    struct funnel_buffer *buf;
+
+    spa_list_consume(buf, &stream->fifo.queue, queue_link) {
+        spa_list_remove(&buf->queue_link);
+        buf->queued = false;
+        return_buffer(stream, buf);
+    }
+    stream->fifo.len = 0;
+    stream->fifo.priming = true;
+    stream->fifo.last_ns = 0;
+}
+
+static void fifo_push(struct funnel_stream *stream, struct funnel_buffer *buf) {
+    uint64_t now = monotonic_ns();
+    uint64_t period = frame_period(stream);
+
+    if (stream->fifo.last_ns) {
+        // Decaying peak of the deviation from the frame period
+        uint64_t interval = now - stream->fifo.last_ns;
+        uint64_t dev =
+            interval > period ? interval - period : period - interval;
+        stream->fifo.jitter_ns -= stream->fifo.jitter_ns / 32;
+        if (dev > stream->fifo.jitter_ns)
+            stream->fifo.jitter_ns = dev;
+    }
+    stream->fifo.last_ns = now;
+
+    uint32_t target = 1 + (stream->fifo.jitter_ns + period - 1) / period;
+    stream->fifo.target = SPA_MIN(target, stream->cur.config.fifo_depth);
+
+    spa_list_append(&stream->fifo.queue, &buf->queue_link);
+    buf->queued = true;
+    stream->fifo.len++;
+}
+
+static void fifo_pop(struct funnel_stream *stream) {
+    if (!stream->fifo.len) {
+        if (!stream->fifo.priming) {
+            pw_log_debug("FIFO underrun, refilling to %u frames",
+                         stream->fifo.target);
+            __atomic_fetch_add(&stream->stats.fifo_underruns, 1,
+                               __ATOMIC_RELAXED);
+            stream->fifo.priming = true;
+        }
+        return;
+    }
+
+    if (stream->fifo.priming) {
+        if (stream->fifo.len < stream->fifo.target)
+            return;
+        stream->fifo.priming = false;
+    }
+
+    struct funnel_buffer *buf =
+        spa_list_first(&stream->fifo.queue, struct funnel_buffer, queue_link);
+    spa_list_remove(&buf->queue_link);
+    buf->queued = false;
+    stream->fifo.len--;
+    stream->pending_buffer = buf;
+}
+
 static void reset_buffers(struct funnel_stream *stream) {
+    fifo_flush(stream);
     if (stream->pending_buffer) {
         return_buffer(stream, stream->pending_buffer);
         stream->pending_buffer = NULL;
     }
     stream->skip_buffer = false;
+    stream->repeat_frame = false;
+    stream->discont = true;
 }
 
 static void on_state_changed(void *data, enum pw_stream_state old,
@@ -346,6 +733,13 @@ static void on_state_changed(void *data, enum pw_stream_state old,
     switch (state) {
     case PW_STREAM_STATE_ERROR:
         reset_buffers(stream);
+        // PipeWire only reports stream errors as free-form text, so go by
+        // the stream state instead: an error after buffers of the current
+        // format were allocated, but before the consumer ever returned one
+        // of them, is most likely an import failure. Errors of the core
+        // itself say nothing about the modifier.
+        if (!stream->ctx->dead && !stream->buffer_returned)
+            handle_import_failure(stream);
         break;
     case PW_STREAM_STATE_PAUSED:
         reset_buffers(stream);
@@ -420,6 +814,166 @@ static bool test_create_dmabuf(struct funnel_stream *stream, uint32_t format,
     return true;
 }
 
+/// Whether explicit sync should be advertised to the consumers.
+/// All consumers share the single release point of a buffer, so with
+/// more than one consumer, only implicit sync keeps every consumer's
+/// reads ordered before the buffer is reused.
+static bool backend_explicit_sync_allowed(struct funnel_stream *stream) {
+    switch (stream->cur.config.backend_sync) {
+    case FUNNEL_SYNC_IMPLICIT:
+        return false;
+    case FUNNEL_SYNC_BOTH:
+        return !stream->fanout;
+    default:
+        return true;
+    }
+}
+
+static void update_buffer_params(struct funnel_stream *stream) {
+    const int buffertypes = (1 << SPA_DATA_DmaBuf);
+
+    spa_auto(spa_pod_dynamic_builder) pod_builder = {0};
+    struct spa_pod_frame f;
+    spa_pod_dynamic_builder_init(&pod_builder, NULL, 0, 1024);
+
+    int num_params = 0;
+    const struct spa_pod *params[8];
+
+    // Buffer parameters for dma-buf with explicit sync
+    if (backend_explicit_sync_allowed(stream)) {
+        spa_pod_builder_push_object(&pod_builder.b, &f,
+                                    SPA_TYPE_OBJECT_ParamBuffers,
+                                    SPA_PARAM_Buffers);
+        spa_pod_builder_add(
+            &pod_builder.b, SPA_PARAM_BUFFERS_buffers,
+            SPA_POD_CHOICE_RANGE_Int(stream->cur.config.buffers.def,
+                                     stream->cur.config.buffers.min,
+                                     stream->cur.config.buffers.max),
+            SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(buffertypes),
+            SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(stream->cur.plane_count) + 2,
+            0);
+        spa_pod_builder_prop(&pod_builder.b, SPA_PARAM_BUFFERS_metaType,
+                             SPA_POD_PROP_FLAG_MANDATORY);
+        spa_pod_builder_int(&pod_builder.b, 1 << SPA_META_SyncTimeline);
+        params[num_params++] =
+            (struct spa_pod *)spa_pod_builder_pop(&pod_builder.b, &f);
+    }
+
+    // Buffer parameters for dma-buf with implicit sync
+    if (stream->cur.config.backend_sync != FUNNEL_SYNC_EXPLICIT) {
+        spa_pod_builder_push_object(&pod_builder.b, &f,
+                                    SPA_TYPE_OBJECT_ParamBuffers,
+                                    SPA_PARAM_Buffers);
+        spa_pod_builder_add(
+            &pod_builder.b, SPA_PARAM_BUFFERS_buffers,
+            SPA_POD_CHOICE_RANGE_Int(stream->cur.config.buffers.def,
+                                     stream->cur.config.buffers.min,
+                                     stream->cur.config.buffers.max),
+            SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(buffertypes),
+            SPA_PARAM_BUFFERS_blocks,
+                            SPA_POD_Int(stream->cur.plane_count), 0);
+        params[num_params++] =
+            (struct spa_pod *)spa_pod_builder_pop(&pod_builder.b, &f);
+    }
+
+    params[num_params++] = (struct spa_pod *)spa_pod_builder_add_object(
+        &pod_builder.b, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+        SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header), SPA_PARAM_META_size,
+        SPA_POD_Int(sizeof(struct spa_meta_header)));
+
+    if (backend_explicit_sync_allowed(stream)) {
+        params[num_params++] = (struct spa_pod *)spa_pod_builder_add_object(
+            &pod_builder.b, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+            SPA_PARAM_META_type, SPA_POD_Id(SPA_META_SyncTimeline),
+            SPA_PARAM_META_size,
+            SPA_POD_Int(sizeof(struct spa_meta_sync_timeline)));
+    }
+
+    pw_stream_update_params(stream->stream, params, num_params);
+}
+
+static void update_consumers(struct funnel_ctx *ctx, uint32_t node_id) {
+    struct funnel_stream *stream;
+
+    spa_list_for_each(stream, &ctx->streams, ctx_link) {
+        if (!stream->stream ||
+            pw_stream_get_node_id(stream->stream) != node_id)
+            continue;
+
+        int consumers = 0;
+        struct funnel_link *link;
+        pw_array_for_each(link, &ctx->links) {
+            if (link->output_node == node_id)
+                consumers++;
+        }
+
+        bool fanout = consumers > 1;
+        if (fanout == stream->fanout)
+            continue;
+        stream->fanout = fanout;
+
+        switch (stream->cur.config.backend_sync) {
+        case FUNNEL_SYNC_BOTH:
+            pw_log_info("Stream %s has %d consumers, %s explicit sync",
+                        stream->name, consumers,
+                        fanout ? "disabling" : "enabling");
+            if (stream->cur.ready)
+                update_buffer_params(stream);
+            break;
+        case FUNNEL_SYNC_EXPLICIT:
+            if (fanout)
+                pw_log_warn("Stream %s has %d consumers, but explicit sync "
+                            "only supports one consumer. The buffer may be "
+                            "reused before all consumers are done with it.",
+                            stream->name, consumers);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static void on_registry_global(void *data, uint32_t id, uint32_t permissions,
+                               const char *type, uint32_t version,
+                               const struct spa_dict *props) {
+    struct funnel_ctx *ctx = data;
+    uint32_t node_id;
+
+    if (!spa_streq(type, PW_TYPE_INTERFACE_Link) || !props)
+        return;
+
+    const char *str = spa_dict_lookup(props, PW_KEY_LINK_OUTPUT_NODE);
+    if (!str || !spa_atou32(str, &node_id, 10))
+        return;
+
+    struct funnel_link *link = pw_array_add(&ctx->links, sizeof(*link));
+    assert(link);
+    link->id = id;
+    link->output_node = node_id;
+
+    update_consumers(ctx, node_id);
+}
+
+static void on_registry_global_remove(void *data, uint32_t id) {
+    struct funnel_ctx *ctx = data;
+    struct funnel_link *link;
+
+    pw_array_for_each(link, &ctx->links) {
+        if (link->id == id) {
+            uint32_t node_id = link->output_node;
+            pw_array_remove(&ctx->links, link);
+            update_consumers(ctx, node_id);
+            return;
+        }
+    }
+}
+
+static const struct pw_registry_events registry_events = {
+    PW_VERSION_REGISTRY_EVENTS,
+    .global = on_registry_global,
+    .global_remove = on_registry_global_remove,
+};
+
 static void on_param_changed(void *data, uint32_t id,
                              const struct spa_pod *format) {
     pw_log_debug("on_param_changed: %d %p", id, format);
@@ -433,9 +987,17 @@ static void on_param_changed(void *data, uint32_t id,
 
     int i;
     uint32_t dmabuf_format;
+    struct spa_fraction old_rate = stream->cur.video_format.framerate;
 
     spa_format_video_raw_parse(format, &stream->cur.video_format);
 
+    struct spa_fraction rate = stream->cur.video_format.framerate;
+    if (rate.num != old_rate.num || rate.denom != old_rate.denom) {
+        pw_log_info("Frame rate changed: %d/%d -> %d/%d", old_rate.num,
+                    old_rate.denom, rate.num, rate.denom);
+        update_timeouts(stream);
+    }
+
     for (i = 0; i < ARRAY_SIZE(supported_formats); i++) {
         if (supported_formats[i].spa_format ==
             stream->cur.video_format.format) {
@@ -483,6 +1045,10 @@ static void on_param_changed(void *data, uint32_t id,
         }
     }
 
+    if (mod_count)
+        mod_count = filter_modifiers(stream->ctx, dmabuf_format, modifiers,
+                                     mod_count);
+
     if (stream->cur.width != stream->cur.video_format.size.width ||
         stream->cur.height != stream->cur.video_format.size.height ||
         stream->cur.format != dmabuf_format) {
@@ -515,89 +1081,238 @@ static void on_param_changed(void *data, uint32_t id,
         return;
     }
 
-    const int buffertypes = (1 << SPA_DATA_DmaBuf);
-
-    spa_auto(spa_pod_dynamic_builder) pod_builder = {0};
-    struct spa_pod_frame f;
-    spa_pod_dynamic_builder_init(&pod_builder, NULL, 0, 1024);
+    update_buffer_params(stream);
+    stream->cur.ready = true;
+    stream->frames_sent = 0;
+    stream->buffer_returned = false;
+    stream->discont = true;
+
+    // Only report the rate once the format is accepted, since it might
+    // otherwise never take effect.
+    if (rate.num != stream->reported_rate.num ||
+        rate.denom != stream->reported_rate.denom) {
+        stream->reported_rate = rate;
+        if (stream->rate_cb)
+            stream->rate_cb(stream->rate_cb_opaque, stream,
+                            FUNNEL_FRACTION(rate.num, rate.denom));
+    }
+}
 
-    int num_params = 0;
-    const struct spa_pod *params[8];
+static void on_command(void *data, const struct spa_command *command) {
+    struct funnel_stream *stream = data;
 
-    // Buffer parameters for dma-buf with explicit sync
-    if (stream->cur.config.backend_sync != FUNNEL_SYNC_IMPLICIT) {
-        spa_pod_builder_push_object(&pod_builder.b, &f,
-                                    SPA_TYPE_OBJECT_ParamBuffers,
-                                    SPA_PARAM_Buffers);
-        spa_pod_builder_add(
-            &pod_builder.b, SPA_PARAM_BUFFERS_buffers,
-            SPA_POD_CHOICE_RANGE_Int(stream->cur.config.buffers.def,
-                                     stream->cur.config.buffers.min,
-                                     stream->cur.config.buffers.max),
-            SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(buffertypes),
-            SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(stream->cur.plane_count) + 2,
-            0);
-        spa_pod_builder_prop(&pod_builder.b, SPA_PARAM_BUFFERS_metaType,
-                             SPA_POD_PROP_FLAG_MANDATORY);
-        spa_pod_builder_int(&pod_builder.b, 1 << SPA_META_SyncTimeline);
-        params[num_params++] =
-            (struct spa_pod *)spa_pod_builder_pop(&pod_builder.b, &f);
+    switch (SPA_NODE_COMMAND_ID(command)) {
+    case SPA_NODE_COMMAND_RequestProcess:
+        if (!pw_stream_is_lazy(stream->stream))
+            return;
+        pw_log_trace("RequestProcess %p", stream);
+        pw_stream_trigger_process(stream->stream);
+        break;
+    default:
+        break;
     }
+}
 
-    // Buffer parameters for dma-buf with implicit sync
-    if (stream->cur.config.backend_sync != FUNNEL_SYNC_EXPLICIT) {
-        spa_pod_builder_push_object(&pod_builder.b, &f,
-                                    SPA_TYPE_OBJECT_ParamBuffers,
-                                    SPA_PARAM_Buffers);
-        spa_pod_builder_add(
-            &pod_builder.b, SPA_PARAM_BUFFERS_buffers,
-            SPA_POD_CHOICE_RANGE_Int(stream->cur.config.buffers.def,
-                                     stream->cur.config.buffers.min,
-                                     stream->cur.config.buffers.max),
-            SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(buffertypes),
-            SPA_PARAM_BUFFERS_blocks,
-                            SPA_POD_Int(stream->cur.plane_count), 0);
-        params[num_params++] =
-            (struct spa_pod *)spa_pod_builder_pop(&pod_builder.b, &f);
+static void unblock_process_thread(struct funnel_stream *stream) {
+    if (stream->cycle_state == SYNC_CYCLE_ACTIVE) {
+        if (stream->cycle_timed)
+            pw_thread_loop_signal(stream->ctx->loop, false);
+        else
+            pw_thread_loop_accept(stream->ctx->loop);
     }
+    // A late cycle already went on, so there is nobody to accept
+    stream->cycle_state = SYNC_CYCLE_INACTIVE;
+}
 
-    params[num_params++] = (struct spa_pod *)spa_pod_builder_add_object(
-        &pod_builder.b, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
-        SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header), SPA_PARAM_META_size,
-        SPA_POD_Int(sizeof(struct spa_meta_header)));
+static void report_stall(struct funnel_stream *stream) {
+    pw_log_warn("libfunnel: Synchronous cycle stalled for over %llu ms, "
+                "continuing without a frame",
+                (unsigned long long)(stream->watchdog_ns / 1000000));
 
-    if (stream->cur.config.backend_sync != FUNNEL_SYNC_IMPLICIT) {
-        params[num_params++] = (struct spa_pod *)spa_pod_builder_add_object(
-            &pod_builder.b, SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
-            SPA_PARAM_META_type, SPA_POD_Id(SPA_META_SyncTimeline),
-            SPA_PARAM_META_size,
-            SPA_POD_Int(sizeof(struct spa_meta_sync_timeline)));
+    __atomic_fetch_add(&stream->stats.watchdog_stalls, 1, __ATOMIC_RELAXED);
+
+    if (stream->dequeued_buffer)
+        stream->dequeued_buffer->late = true;
+
+#ifdef HAVE_EXECINFO_H
+    char **symbols = backtrace_symbols(stream->dequeue_stack,
+                                       stream->dequeue_stack_depth);
+    if (symbols) {
+        pw_log_warn("libfunnel: The buffer was dequeued at:");
+        for (int i = 0; i < stream->dequeue_stack_depth; i++)
+            pw_log_warn("    %s", symbols[i]);
+        free(symbols);
+    }
+#endif
+}
+
+static void wait_sync_cycle(struct funnel_stream *stream, uint64_t timeout_ns,
+                            bool watchdog) {
+    struct pw_thread_loop *loop = stream->ctx->loop;
+    struct timespec abstime;
+
+    // Like pw_thread_loop_signal(loop, true), but give up at the deadline
+    stream->cycle_timed = true;
+    pw_thread_loop_get_time(loop, &abstime, timeout_ns);
+    pw_thread_loop_signal(loop, false);
+
+    while (stream->cycle_state == SYNC_CYCLE_ACTIVE) {
+        if (pw_thread_loop_timed_wait_full(loop, &abstime) == -ETIMEDOUT &&
+            stream->cycle_state == SYNC_CYCLE_ACTIVE) {
+            stream->cycle_state = SYNC_CYCLE_LATE;
+            if (watchdog) {
+                report_stall(stream);
+            } else {
+                pw_log_debug("Sync cycle missed its deadline");
+                __atomic_fetch_add(&stream->stats.sync_deadline_misses, 1,
+                                   __ATOMIC_RELAXED);
+            }
+        }
     }
 
-    pw_stream_update_params(stream->stream, params, num_params);
-    stream->cur.ready = true;
+    stream->cycle_timed = false;
 }
 
-static void on_command(void *data, const struct spa_command *command) {
-    struct funnel_stream *stream = data;
+/// Make sure that the consumer release point of a buffer is, or will be,
+/// signaled.
+static void buffer_check_release_point(struct funnel_buffer *buf) {
+    struct funnel_stream *stream = buf->stream;
+    int gbm_fd = gbm_device_get_fd(stream->gbm);
+    int ret;
 
-    switch (SPA_NODE_COMMAND_ID(command)) {
-    case SPA_NODE_COMMAND_RequestProcess:
-        if (!pw_stream_is_lazy(stream->stream))
+#ifdef SPA_META_SYNC_TIMELINE_UNSCHEDULED_RELEASE
+    // Consumers that know about this flag clear it once they have scheduled
+    // the release point, which guarantees that it will be signaled.
+    if (!(buf->stl->flags & SPA_META_SYNC_TIMELINE_UNSCHEDULED_RELEASE)) {
+        if (!buf->backend_sync_reliable)
+            pw_log_debug("Consumer schedules release points for buffer %p",
+                         buf);
+        buf->backend_sync_reliable = true;
+        count_sync_ioctls(stream, 0, 1);
+        return;
+    }
+#endif
+
+    if (!buf->backend_sync_reliable) {
+        // Older consumers might just drop the buffer without signaling,
+        // so check whether the point was materialized.
+        ret = drmSyncobjTimelineWait(gbm_fd, &buf->acquire.handle,
+                                     &buf->acquire.point, 1, 0,
+                                     DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+                                     NULL);
+        count_sync_ioctls(stream, 1, 0);
+        if (ret >= 0)
             return;
-        pw_log_trace("RequestProcess %p", stream);
-        pw_stream_trigger_process(stream->stream);
-        break;
-    default:
-        break;
     }
+
+    pw_log_info("Sync point 0x%x/%lld is not scheduled, assuming "
+                "buffer was dropped.",
+                buf->acquire.handle, (long long)buf->acquire.point);
+    ret = drmSyncobjTimelineSignal(gbm_fd, &buf->acquire.handle,
+                                   &buf->acquire.point, 1);
+    assert(ret >= 0);
+    count_sync_ioctls(stream, 1, 0);
 }
 
-static void unblock_process_thread(struct funnel_stream *stream) {
-    if (stream->cycle_state == SYNC_CYCLE_ACTIVE) {
-        pw_thread_loop_accept(stream->ctx->loop);
+static void send_buffer(struct funnel_stream *stream,
+                        struct funnel_buffer *buf) {
+    assert(buf->pw_buffer);
+    pw_log_trace("Queued buffer");
+    if (buf->backend_sync) {
+        // We are sending off this buffer, so we need a new acquire point
+        buf->acquire.point++;
+        // The consumer acquire point is our most recently used
+        // release point, which is the previous one (the current
+        // one is the *next* point).
+        buf->stl->acquire_point = buf->release.point - 1;
+        // The consumer release point is our new acquire point
+        buf->stl->release_point = buf->acquire.point;
+#ifdef SPA_META_SYNC_TIMELINE_UNSCHEDULED_RELEASE
+        buf->stl->flags |= SPA_META_SYNC_TIMELINE_UNSCHEDULED_RELEASE;
+#endif
+        buf->release_pending = true;
+        pw_log_trace(
+            "Buffer consumer acquire/release points: 0x%x:%lld, 0x%x:%lld",
+            buf->release.handle, (long long)buf->stl->acquire_point,
+            buf->acquire.handle, (long long)buf->stl->release_point);
+    }
+    if (buf->header) {
+        buf->header->flags = 0;
+        if (stream->discont)
+            buf->header->flags |= SPA_META_HEADER_FLAG_DISCONT;
+        if (buf->corrupted)
+            buf->header->flags |= SPA_META_HEADER_FLAG_CORRUPTED;
+        buf->header->offset = 0;
+        buf->header->pts = buf->pts;
+        // Video frames are never reordered
+        buf->header->dts_offset = 0;
+        buf->header->seq = buf->seq;
+    }
+    stream->discont = false;
+    pw_stream_queue_buffer(stream->stream, buf->pw_buffer);
+    stream->clock.idle_cycles = 0;
+    stream->last_sent = buf;
+    buf->sent_count++;
+    stream->frames_sent++;
+    __atomic_fetch_add(&stream->stats.frames_sent, 1, __ATOMIC_RELAXED);
+}
+
+/// Get the most recently sent buffer back from the consumer, to send it again
+static struct funnel_buffer *reclaim_last_sent(struct funnel_stream *stream) {
+    struct funnel_buffer *buf = stream->last_sent;
+
+    if (!buf || !buf->pw_buffer || buf->dequeued || !stream->num_buffers)
+        return NULL;
+
+    // Buffers come back from the consumer in any order, so look for it and
+    // put the others back. They go back to the end of the free queue, so
+    // the free buffers ahead of it end up behind the ones that were after
+    // it. That only changes which free buffer the next dequeue gets.
+    struct pw_buffer *others[MAX_BUFFERS];
+    int num_others = 0;
+    bool found = false;
+
+    for (int i = 0; i < SPA_MIN(stream->num_buffers, MAX_BUFFERS); i++) {
+        struct pw_buffer *pwbuffer = pw_stream_dequeue_buffer(stream->stream);
+        if (!pwbuffer)
+            break;
+        if (pwbuffer == buf->pw_buffer) {
+            found = true;
+            break;
+        }
+        others[num_others++] = pwbuffer;
     }
-    stream->cycle_state = SYNC_CYCLE_INACTIVE;
+
+    for (int i = 0; i < num_others; i++)
+        pw_stream_return_buffer(stream->stream, others[i]);
+
+    // Still held by the consumer
+    if (!found)
+        return NULL;
+
+    stream->buffer_returned = true;
+
+    if (buf->backend_sync) {
+        int gbm_fd = gbm_device_get_fd(stream->gbm);
+
+        if (buf->release_pending) {
+            buf->release_pending = false;
+            buffer_check_release_point(buf);
+        }
+
+        // Timeline points must be signaled in order, so the consumer has to
+        // be done with the previous send before it gets the next release
+        // point.
+        int ret = drmSyncobjTimelineWait(gbm_fd, &buf->acquire.handle,
+                                         &buf->acquire.point, 1, 0, 0, NULL);
+        count_sync_ioctls(stream, 1, 0);
+        if (ret < 0) {
+            pw_stream_return_buffer(stream->stream, buf->pw_buffer);
+            return NULL;
+        }
+    }
+
+    return buf;
 }
 
 static void on_process(void *data) {
@@ -609,40 +1324,64 @@ static void on_process(void *data) {
         return;
 
     if (stream->cur.config.mode == FUNNEL_SYNCHRONOUS) {
-        // Sync mode handshake
-        if (stream->cycle_state == SYNC_CYCLE_WAITING) {
+        // Sync mode handshake. A frame that missed the previous cycle's
+        // deadline takes this cycle, and the handshake waits for the next.
+        if (stream->cycle_state == SYNC_CYCLE_WAITING &&
+            !stream->pending_buffer) {
             stream->cycle_state = SYNC_CYCLE_ACTIVE;
             pw_log_trace("Signal sync");
-            pw_thread_loop_signal(stream->ctx->loop, true);
+            if (stream->sync_deadline_ns)
+                wait_sync_cycle(stream, stream->sync_deadline_ns, false);
+            else if (stream->watchdog_ns)
+                wait_sync_cycle(stream, stream->watchdog_ns, true);
+            else
+                pw_thread_loop_signal(stream->ctx->loop, true);
             pw_log_trace("Accepted");
         }
         // We should have a buffer now, if the cycle succeeded
     }
 
-    if (stream->pending_buffer) {
+    if (stream->cur.config.mode == FUNNEL_FIFO && !stream->pending_buffer)
+        fifo_pop(stream);
+
+    bool hold = false;
+    if (stream->pending_buffer && stream->pending_buffer->target_ns &&
+        stream->cur.config.mode != FUNNEL_SYNCHRONOUS) {
+        // Send in the cycle closest to the target time
+        uint64_t target = stream->pending_buffer->target_ns;
+        uint64_t half_period = frame_period(stream) / 2;
+
+        if (monotonic_ns() + half_period < target) {
+            hold = true;
+            pw_log_trace("Holding buffer until %llu",
+                         (unsigned long long)target);
+
+            if (!stream->clock.active)
+                arm_hold_wakeup(stream);
+        }
+    }
+
+    if (stream->pending_buffer && !hold) {
         struct funnel_buffer *buf = stream->pending_buffer;
         stream->pending_buffer = NULL;
 
-        assert(buf->pw_buffer);
-        pw_log_trace("Queued buffer");
-        if (buf->backend_sync) {
-            // We are sending off this buffer, so we need a new acquire point
-            buf->acquire.point++;
-            // The consumer acquire point is our most recently used
-            // release point, which is the previous one (the current
-            // one is the *next* point).
-            buf->stl->acquire_point = buf->release.point - 1;
-            // The consumer release point is our new acquire point
-            buf->stl->release_point = buf->acquire.point;
-            pw_log_trace(
-                "Buffer consumer acquire/release points: 0x%x:%lld, 0x%x:%lld",
-                buf->release.handle, (long long)buf->stl->acquire_point,
-                buf->acquire.handle, (long long)buf->stl->release_point);
-        }
-        pw_stream_queue_buffer(stream->stream, buf->pw_buffer);
-        buf->sent_count++;
-    } else if (stream->skip_buffer) {
+        send_buffer(stream, buf);
+        // A new frame supersedes a repeat
+        stream->repeat_frame = false;
+    } else if (!stream->pending_buffer && stream->skip_buffer) {
         stream->skip_buffer = false;
+    } else if (!stream->pending_buffer && stream->repeat_frame) {
+        stream->repeat_frame = false;
+
+        struct funnel_buffer *buf = reclaim_last_sent(stream);
+        if (buf) {
+            pw_log_trace("Repeating buffer %p", buf);
+            buf->pts = monotonic_ns();
+            buf->seq = stream->seq++;
+            send_buffer(stream, buf);
+        } else {
+            pw_log_trace("Last buffer is not available for repeating");
+        }
     }
 
     pw_thread_loop_signal(stream->ctx->loop, false);
@@ -664,11 +1403,57 @@ static void on_timeout(void *userdata, uint64_t expirations) {
     struct funnel_stream *stream = userdata;
 
     pw_log_trace("Timeout %p", stream);
+
+    if (!stream->clock.active) {
+        // Wakeup for a held frame, see on_process()
+        pw_stream_trigger_process(stream->stream);
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    uint64_t deadline = clock_deadline(stream);
+    uint64_t late = now > deadline ? now - deadline : 0;
+    uint64_t period = clock_period(stream);
+
+    __atomic_fetch_add(&stream->stats.timer_wakeups, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stream->stats.timer_late_ns_total, late,
+                       __ATOMIC_RELAXED);
+    // Only this thread writes the maximum, so load/store is enough
+    if (late > __atomic_load_n(&stream->stats.timer_late_ns_max,
+                               __ATOMIC_RELAXED))
+        __atomic_store_n(&stream->stats.timer_late_ns_max, late,
+                         __ATOMIC_RELAXED);
+
+    // A held frame (see funnel_stream_enqueue_at()) is not idle
+    if (stream->clock.idle_timeout && !stream->pending_buffer &&
+        !stream->fifo.len &&
+        stream->clock.idle_cycles++ >= stream->clock.idle_timeout) {
+        // Nothing was sent for a while, leave the timer disarmed until
+        // the application dequeues or enqueues a frame again.
+        pw_log_debug("Driver clock idle for %u cycles, suspending",
+                     stream->clock.idle_timeout);
+        stream->clock.suspended = true;
+        return;
+    }
+
+    // Skip any deadlines that have already passed instead of bursting
+    uint64_t missed = period ? late / period : 0;
+    if (missed) {
+        pw_log_debug("Driver timer %llu ns late, skipping %llu cycles",
+                     (unsigned long long)late, (unsigned long long)missed);
+        __atomic_fetch_add(&stream->stats.timer_cycles_missed, missed,
+                           __ATOMIC_RELAXED);
+    }
+    clock_advance(stream, missed + 1);
+    clock_arm(stream);
+
     pw_stream_trigger_process(stream->stream);
 }
 
 static struct spa_pod *
 build_format(enum spa_video_format format, struct spa_rectangle *resolution,
+             struct spa_rectangle *min_resolution,
+             struct spa_rectangle *max_resolution,
              struct spa_fraction *def_rate, struct spa_fraction *min_rate,
              struct spa_fraction *max_rate, const uint64_t *modifiers,
              size_t num_modifiers, uint32_t modifiers_flags) {
@@ -684,8 +1469,14 @@ build_format(enum spa_video_format format, struct spa_rectangle *resolution,
                         SPA_POD_Id(SPA_MEDIA_TYPE_video), 0);
     spa_pod_builder_add(b, SPA_FORMAT_mediaSubtype,
                         SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw), 0);
-    spa_pod_builder_add(b, SPA_FORMAT_VIDEO_size, SPA_POD_Rectangle(resolution),
-                        0);
+    if (min_resolution && max_resolution)
+        spa_pod_builder_add(b, SPA_FORMAT_VIDEO_size,
+                            SPA_POD_CHOICE_RANGE_Rectangle(
+                                resolution, min_resolution, max_resolution),
+                            0);
+    else
+        spa_pod_builder_add(b, SPA_FORMAT_VIDEO_size,
+                            SPA_POD_Rectangle(resolution), 0);
     // spa_pod_builder_add(b, SPA_FORMAT_VIDEO_framerate,
     //                     SPA_POD_Fraction(def_rate), 0);
     spa_pod_builder_add(
@@ -722,22 +1513,50 @@ static int build_formats(struct funnel_stream *stream, bool fixate,
 
     struct spa_rectangle resolution =
         SPA_RECTANGLE(config->width, config->height);
+    struct spa_rectangle min_resolution =
+        SPA_RECTANGLE(config->min_size.width, config->min_size.height);
+    struct spa_rectangle max_resolution =
+        SPA_RECTANGLE(config->max_size.width, config->max_size.height);
+    bool size_range = config->max_size.width && config->max_size.height;
 
     int num_params = 0;
     if (fixate) {
+        // The fixated format uses the size the consumer picked
         num_params++;
         *params++ = build_format(
-            stream->cur.video_format.format, &resolution, &def_rate, &min_rate,
-            &max_rate, &stream->cur.modifier, 1, SPA_POD_PROP_FLAG_MANDATORY);
+            stream->cur.video_format.format, &stream->cur.video_format.size,
+            NULL, NULL, &def_rate, &min_rate, &max_rate, &stream->cur.modifier,
+            1, SPA_POD_PROP_FLAG_MANDATORY);
     }
 
-    struct funnel_format *format;
-    pw_array_for_each (format, &config->formats) {
-        num_params++;
-        *params++ = build_format(
-            format->spa_format, &resolution, &def_rate, &min_rate, &max_rate,
-            format->modifiers, format->num_modifiers,
-            SPA_POD_PROP_FLAG_MANDATORY | SPA_POD_PROP_FLAG_DONT_FIXATE);
+    // With prefer_opaque, formats without alpha are advertised first (in
+    // their original order), so they win whenever the consumer accepts them.
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1 && !config->prefer_opaque)
+            break;
+
+        struct funnel_format *format;
+        pw_array_for_each (format, &config->formats) {
+            if (config->prefer_opaque &&
+                format_has_alpha(format->format) == (pass == 0))
+                continue;
+
+            uint64_t *modifiers =
+                calloc(format->num_modifiers, sizeof(uint64_t));
+            memcpy(modifiers, format->modifiers,
+                   format->num_modifiers * sizeof(uint64_t));
+            size_t num_modifiers = filter_modifiers(
+                stream->ctx, format->format, modifiers, format->num_modifiers);
+
+            num_params++;
+            *params++ = build_format(
+                format->spa_format, &resolution,
+                size_range ? &min_resolution : NULL,
+                size_range ? &max_resolution : NULL, &def_rate, &min_rate,
+                &max_rate, modifiers, num_modifiers,
+                SPA_POD_PROP_FLAG_MANDATORY | SPA_POD_PROP_FLAG_DONT_FIXATE);
+            free(modifiers);
+        }
     }
 
     return num_params;
@@ -771,6 +1590,15 @@ int funnel_init(struct funnel_ctx **pctx) {
 
     pw_core_add_listener(ctx->core, &ctx->core_listener, &core_events, ctx);
 
+    pw_array_init(&ctx->bad_modifiers, 16);
+    pw_array_init(&ctx->links, 16);
+    spa_list_init(&ctx->streams);
+
+    ctx->registry = pw_core_get_registry(ctx->core, PW_VERSION_REGISTRY, 0);
+    assert(ctx->registry);
+    pw_registry_add_listener(ctx->registry, &ctx->registry_listener,
+                             &registry_events, ctx);
+
     pw_thread_loop_unlock(ctx->loop);
 
     *pctx = ctx;
@@ -786,6 +1614,11 @@ void funnel_shutdown(struct funnel_ctx *ctx) {
     /* Thread loop should be unlocked here */
     pw_thread_loop_stop(ctx->loop);
 
+    if (ctx->registry) {
+        spa_hook_remove(&ctx->registry_listener);
+        pw_proxy_destroy((struct pw_proxy *)ctx->registry);
+    }
+
     if (ctx->core)
         pw_core_disconnect(ctx->core);
 
@@ -794,6 +1627,8 @@ void funnel_shutdown(struct funnel_ctx *ctx) {
 
     pw_thread_loop_destroy(ctx->loop);
 
+    pw_array_clear(&ctx->bad_modifiers);
+    pw_array_clear(&ctx->links);
     free(ctx);
     pw_deinit();
 }
@@ -814,7 +1649,11 @@ int funnel_stream_create(struct funnel_ctx *ctx, const char *name,
 
     stream->ctx = ctx;
     stream->name = strdup(name);
+    spa_list_append(&ctx->streams, &stream->ctx_link);
+    spa_list_init(&stream->fifo.queue);
 
+    stream->config.fifo_depth = 3;
+    stream->config.node.driver_priority = -1;
     funnel_stream_set_mode(stream, FUNNEL_ASYNC);
 
     stream->config.backend_sync = FUNNEL_SYNC_IMPLICIT;
@@ -833,6 +1672,10 @@ int funnel_stream_create(struct funnel_ctx *ctx, const char *name,
                                       on_timeout, stream);
     assert(stream->timer);
 
+    stream->reconnect = pw_loop_add_event(pw_thread_loop_get_loop(ctx->loop),
+                                          on_reconnect, stream);
+    assert(stream->reconnect);
+
     *pstream = stream;
 
     UNLOCK_RETURN(0);
@@ -847,6 +1690,12 @@ void funnel_stream_set_buffer_callbacks(struct funnel_stream *stream,
     stream->cb_opaque = opaque;
 }
 
+void funnel_stream_set_rate_callback(struct funnel_stream *stream,
+                                     funnel_rate_callback cb, void *opaque) {
+    stream->rate_cb = cb;
+    stream->rate_cb_opaque = opaque;
+}
+
 int funnel_stream_init_gbm(struct funnel_stream *stream, int gbm_fd) {
     if (stream->gbm)
         return -EEXIST;
@@ -1024,6 +1873,89 @@ int funnel_stream_set_size(struct funnel_stream *stream, uint32_t width,
     return 0;
 }
 
+int funnel_stream_set_size_range(struct funnel_stream *stream,
+                                 uint32_t min_width, uint32_t min_height,
+                                 uint32_t max_width, uint32_t max_height) {
+    assert(stream);
+
+    bool none = !min_width && !min_height && !max_width && !max_height;
+
+    if (!none && (!min_width || !min_height || min_width > max_width ||
+                  min_height > max_height))
+        return -EINVAL;
+
+    stream->config.min_size.width = min_width;
+    stream->config.min_size.height = min_height;
+    stream->config.max_size.width = max_width;
+    stream->config.max_size.height = max_height;
+    stream->config_pending = true;
+
+    return 0;
+}
+
+void funnel_stream_set_prefer_opaque(struct funnel_stream *stream,
+                                     bool prefer_opaque) {
+    assert(stream);
+
+    stream->config.prefer_opaque = prefer_opaque;
+    stream->config_pending = true;
+}
+
+int funnel_stream_set_driver_priority(struct funnel_stream *stream,
+                                      int priority) {
+    assert(stream);
+
+    if (priority < -1)
+        return -EINVAL;
+
+    stream->config.node.driver_priority = priority;
+    stream->config_pending = true;
+
+    return 0;
+}
+
+int funnel_stream_set_latency(struct funnel_stream *stream,
+                              struct funnel_fraction latency) {
+    assert(stream);
+
+    if (latency.num && !latency.den)
+        return -EINVAL;
+
+    stream->config.node.latency = latency;
+    stream->config_pending = true;
+
+    return 0;
+}
+
+void funnel_stream_set_force_rate(struct funnel_stream *stream,
+                                  uint32_t rate) {
+    assert(stream);
+
+    stream->config.node.force_rate = rate;
+    stream->config_pending = true;
+}
+
+int funnel_stream_set_group(struct funnel_stream *stream, const char *group) {
+    assert(stream);
+
+    if (group && strlen(group) >= sizeof(stream->config.node.group))
+        return -EINVAL;
+
+    snprintf(stream->config.node.group, sizeof(stream->config.node.group),
+             "%s", group ? group : "");
+    stream->config_pending = true;
+
+    return 0;
+}
+
+void funnel_stream_set_always_process(struct funnel_stream *stream,
+                                      bool always_process) {
+    assert(stream);
+
+    stream->config.node.always_process = always_process;
+    stream->config_pending = true;
+}
+
 int funnel_stream_set_mode(struct funnel_stream *stream,
                            enum funnel_mode mode) {
     assert(stream);
@@ -1041,6 +1973,12 @@ int funnel_stream_set_mode(struct funnel_stream *stream,
         stream->config.buffers.min = 3;
         stream->config.buffers.max = 8;
         break;
+    case FUNNEL_FIFO:
+        // Queued frames on top of the double buffered counts
+        stream->config.buffers.def = 6 + stream->config.fifo_depth;
+        stream->config.buffers.min = 4 + stream->config.fifo_depth;
+        stream->config.buffers.max = 8 + stream->config.fifo_depth;
+        break;
     default:
         return -EINVAL;
     }
@@ -1051,6 +1989,22 @@ int funnel_stream_set_mode(struct funnel_stream *stream,
     return 0;
 }
 
+int funnel_stream_set_fifo_depth(struct funnel_stream *stream,
+                                 uint32_t depth) {
+    assert(stream);
+
+    if (depth < 1 || depth > 16)
+        return -EINVAL;
+
+    stream->config.fifo_depth = depth;
+    if (stream->config.mode == FUNNEL_FIFO)
+        return funnel_stream_set_mode(stream, FUNNEL_FIFO);
+
+    stream->config_pending = true;
+
+    return 0;
+}
+
 int funnel_stream_validate_sync(struct funnel_stream *stream,
                                 enum funnel_sync *frontend,
                                 enum funnel_sync *backend) {
@@ -1096,11 +2050,7 @@ int funnel_stream_validate_sync(struct funnel_stream *stream,
 
     switch (*backend) {
     case FUNNEL_SYNC_EXPLICIT:
-        if (*frontend == FUNNEL_SYNC_IMPLICIT) {
-            pw_log_error(
-                "Converting explicit sync to implicit is not supported");
-            return -EINVAL;
-        } else if (*frontend == FUNNEL_SYNC_BOTH)
+        if (*frontend == FUNNEL_SYNC_BOTH)
             *frontend = FUNNEL_SYNC_EXPLICIT;
         if (!stream->gbm_timeline_sync) {
             pw_log_error("Explicit sync requested for PipeWire, but the GPU "
@@ -1110,11 +2060,6 @@ int funnel_stream_validate_sync(struct funnel_stream *stream,
         }
         break;
     case FUNNEL_SYNC_BOTH:
-        if (*frontend == FUNNEL_SYNC_IMPLICIT) {
-            pw_log_error(
-                "Converting explicit sync to implicit is not supported");
-            return -EINVAL;
-        }
         if (!stream->gbm_implicit_sync) {
             pw_log_info(
                 "FUNNEL_SYNC_EXPLICIT forced for backend due to missing "
@@ -1130,6 +2075,7 @@ int funnel_stream_validate_sync(struct funnel_stream *stream,
         }
         if (*frontend == FUNNEL_SYNC_BOTH)
             *frontend = FUNNEL_SYNC_IMPLICIT;
+        break;
     default:
         return -EINVAL;
     }
@@ -1145,41 +2091,264 @@ int funnel_stream_set_sync(struct funnel_stream *stream,
     if (ret)
         return ret;
 
-    stream->config.frontend_sync = frontend;
-    stream->config.backend_sync = backend;
-    stream->config_pending = true;
-    return 0;
+    stream->config.frontend_sync = frontend;
+    stream->config.backend_sync = backend;
+    stream->config_pending = true;
+    return 0;
+}
+
+int funnel_stream_set_rate(struct funnel_stream *stream,
+                           struct funnel_fraction def,
+                           struct funnel_fraction min,
+                           struct funnel_fraction max) {
+    if (!def.den || !min.den || !max.den)
+        return -EINVAL;
+
+    stream->config.rate.def = def;
+    stream->config.rate.min = min;
+    stream->config.rate.max = max;
+    stream->config_pending = true;
+
+    return 0;
+}
+
+int funnel_stream_get_rate(struct funnel_stream *stream,
+                           struct funnel_fraction *rate) {
+    struct funnel_ctx *ctx = stream->ctx;
+    pw_thread_loop_lock(ctx->loop);
+
+    if (!stream->cur.ready) {
+        *rate = FUNNEL_FRACTION(0, 0);
+        UNLOCK_RETURN(-EINPROGRESS);
+    }
+
+    rate->num = stream->cur.video_format.framerate.num;
+    rate->den = stream->cur.video_format.framerate.denom;
+
+    UNLOCK_RETURN(0);
+}
+
+int funnel_stream_get_frame_skip(struct funnel_stream *stream,
+                                 struct funnel_fraction render_rate,
+                                 uint32_t *pskip) {
+    struct funnel_ctx *ctx = stream->ctx;
+
+    *pskip = 0;
+    if (!render_rate.den)
+        return -EINVAL;
+
+    pw_thread_loop_lock(ctx->loop);
+
+    if (!stream->cur.ready)
+        UNLOCK_RETURN(-EINPROGRESS);
+
+    struct spa_fraction rate = stream->cur.video_format.framerate;
+
+    // Variable rate or unknown render rate, send every frame
+    if (!rate.num || !rate.denom || !render_rate.num)
+        UNLOCK_RETURN(0);
+
+    // Send one frame every floor(render_rate / rate) frames, which never
+    // drops below the negotiated rate.
+    uint64_t ratio = ((uint64_t)render_rate.num * rate.denom) /
+                     ((uint64_t)render_rate.den * rate.num);
+    if (ratio > 1)
+        *pskip = ratio - 1;
+
+    UNLOCK_RETURN(0);
+}
+
+void funnel_stream_set_idle_timeout(struct funnel_stream *stream,
+                                    uint32_t cycles) {
+    struct funnel_ctx *ctx = stream->ctx;
+
+    pw_thread_loop_lock(ctx->loop);
+
+    stream->clock.idle_timeout = cycles;
+    if (!cycles)
+        clock_resume(stream);
+
+    pw_thread_loop_unlock(ctx->loop);
+}
+
+void funnel_stream_set_sync_deadline(struct funnel_stream *stream,
+                                     uint64_t budget_ns) {
+    struct funnel_ctx *ctx = stream->ctx;
+
+    pw_thread_loop_lock(ctx->loop);
+    stream->sync_deadline_ns = budget_ns;
+    pw_thread_loop_unlock(ctx->loop);
+}
+
+void funnel_stream_set_watchdog(struct funnel_stream *stream,
+                                uint64_t timeout_ns) {
+    struct funnel_ctx *ctx = stream->ctx;
+
+    pw_thread_loop_lock(ctx->loop);
+    stream->watchdog_ns = timeout_ns;
+    pw_thread_loop_unlock(ctx->loop);
+}
+
+int funnel_stream_set_clock_reference(struct funnel_stream *stream,
+                                      uint64_t time_ns) {
+    struct funnel_ctx *ctx = stream->ctx;
+
+    if (!time_ns)
+        return -EINVAL;
+
+    pw_thread_loop_lock(ctx->loop);
+
+    stream->clock.ref_ns = time_ns;
+
+    // Not driving, the phase is applied when the driver clock starts
+    if (!stream->clock.active || stream->clock.suspended)
+        UNLOCK_RETURN(0);
+
+    // Move a quarter of the way towards the reference phase on each
+    // update. This smooths out timestamp jitter and follows small rate
+    // differences between the reference and the negotiated rate.
+    int64_t error = clock_phase_error(stream, time_ns);
+    stream->clock.base_ns += error / 4;
+    pw_log_trace("Clock reference phase error: %lld ns", (long long)error);
+
+    clock_arm(stream);
+
+    UNLOCK_RETURN(0);
+}
+
+void funnel_stream_get_stats(struct funnel_stream *stream,
+                             struct funnel_stream_stats *stats) {
+    stats->frames_sent =
+        __atomic_load_n(&stream->stats.frames_sent, __ATOMIC_RELAXED);
+    stats->sync_ioctls =
+        __atomic_load_n(&stream->stats.sync_ioctls, __ATOMIC_RELAXED);
+    stats->sync_ioctls_skipped =
+        __atomic_load_n(&stream->stats.sync_ioctls_skipped, __ATOMIC_RELAXED);
+    stats->timer_wakeups =
+        __atomic_load_n(&stream->stats.timer_wakeups, __ATOMIC_RELAXED);
+    stats->timer_cycles_missed =
+        __atomic_load_n(&stream->stats.timer_cycles_missed, __ATOMIC_RELAXED);
+    stats->timer_late_ns_total =
+        __atomic_load_n(&stream->stats.timer_late_ns_total, __ATOMIC_RELAXED);
+    stats->timer_late_ns_max =
+        __atomic_load_n(&stream->stats.timer_late_ns_max, __ATOMIC_RELAXED);
+    stats->fifo_underruns =
+        __atomic_load_n(&stream->stats.fifo_underruns, __ATOMIC_RELAXED);
+    stats->sync_deadline_misses =
+        __atomic_load_n(&stream->stats.sync_deadline_misses, __ATOMIC_RELAXED);
+    stats->watchdog_stalls =
+        __atomic_load_n(&stream->stats.watchdog_stalls, __ATOMIC_RELAXED);
+}
+
+static uint32_t build_node_props(const struct funnel_stream_config *config,
+                                 struct funnel_node_props *props) {
+    struct spa_dict_item *items = props->items;
+    const char *driver_prio = NULL;
+    const char *latency = NULL, *force_rate = NULL;
+    bool lazy = false, request = false;
+    switch (config->mode) {
+    case FUNNEL_ASYNC:
+        driver_prio = "1";
+        request = true;
+        break;
+    case FUNNEL_DOUBLE_BUFFERED:
+    case FUNNEL_SINGLE_BUFFERED:
+    case FUNNEL_SYNCHRONOUS:
+    case FUNNEL_FIFO:
+        lazy = true;
+        break;
+    }
+
+    if (config->node.driver_priority >= 0) {
+        snprintf(props->driver_priority, sizeof(props->driver_priority), "%d",
+                 config->node.driver_priority);
+        driver_prio = props->driver_priority;
+    }
+
+    if (config->node.latency.num) {
+        snprintf(props->latency, sizeof(props->latency), "%u/%u",
+                 config->node.latency.num, config->node.latency.den);
+        latency = props->latency;
+    }
+
+    if (config->node.force_rate) {
+        snprintf(props->force_rate, sizeof(props->force_rate), "%u",
+                 config->node.force_rate);
+        force_rate = props->force_rate;
+    }
+
+    // Unset properties are kept with a NULL value, so that updating the
+    // properties of an existing stream removes them.
+    uint32_t n_items = 0;
+    items[n_items++] =
+        SPA_DICT_ITEM_INIT(PW_KEY_NODE_SUPPORTS_LAZY, lazy ? "1" : NULL);
+    items[n_items++] =
+        SPA_DICT_ITEM_INIT(PW_KEY_NODE_SUPPORTS_REQUEST, request ? "1" : NULL);
+    items[n_items++] = SPA_DICT_ITEM_INIT(PW_KEY_PRIORITY_DRIVER, driver_prio);
+    items[n_items++] = SPA_DICT_ITEM_INIT(PW_KEY_NODE_LATENCY, latency);
+    items[n_items++] = SPA_DICT_ITEM_INIT(PW_KEY_NODE_FORCE_RATE, force_rate);
+    items[n_items++] = SPA_DICT_ITEM_INIT(
+        PW_KEY_NODE_GROUP, config->node.group[0] ? config->node.group : NULL);
+    items[n_items++] =
+        SPA_DICT_ITEM_INIT(PW_KEY_NODE_ALWAYS_PROCESS,
+                           config->node.always_process ? "true" : NULL);
+    assert(n_items <= NODE_PROPS_MAX);
+
+    return n_items;
 }
 
-int funnel_stream_set_rate(struct funnel_stream *stream,
-                           struct funnel_fraction def,
-                           struct funnel_fraction min,
-                           struct funnel_fraction max) {
-    if (!def.den || !min.den || !max.den)
-        return -EINVAL;
+static bool funnel_formats_equal(struct pw_array *a, struct pw_array *b) {
+    size_t count = pw_array_get_len(a, struct funnel_format);
 
-    stream->config.rate.def = def;
-    stream->config.rate.min = min;
-    stream->config.rate.max = max;
-    stream->config_pending = true;
+    if (count != pw_array_get_len(b, struct funnel_format))
+        return false;
 
-    return 0;
+    struct funnel_format *fa = a->data, *fb = b->data;
+    for (size_t i = 0; i < count; i++) {
+        if (fa[i].format != fb[i].format ||
+            fa[i].num_modifiers != fb[i].num_modifiers ||
+            memcmp(fa[i].modifiers, fb[i].modifiers,
+                   fa[i].num_modifiers * sizeof(uint64_t)))
+            return false;
+    }
+
+    return true;
 }
 
-int funnel_stream_get_rate(struct funnel_stream *stream,
-                           struct funnel_fraction *rate) {
-    struct funnel_ctx *ctx = stream->ctx;
-    pw_thread_loop_lock(ctx->loop);
+static uint32_t config_diff(struct funnel_stream_config *old,
+                            struct funnel_stream_config *new) {
+    uint32_t changes = 0;
 
-    if (!stream->cur.ready) {
-        *rate = FUNNEL_FRACTION(0, 0);
-        UNLOCK_RETURN(-EINPROGRESS);
+    struct funnel_node_props old_props, new_props;
+    uint32_t n_items = build_node_props(old, &old_props);
+    uint32_t n_new_items = build_node_props(new, &new_props);
+    assert(n_items == n_new_items);
+
+    for (uint32_t i = 0; i < n_items; i++) {
+        if (!spa_streq(old_props.items[i].value, new_props.items[i].value))
+            changes |= CONFIG_CHANGED_PROPS;
     }
 
-    rate->num = stream->cur.video_format.framerate.num;
-    rate->den = stream->cur.video_format.framerate.denom;
+    if (old->buffers.def != new->buffers.def ||
+        old->buffers.min != new->buffers.min ||
+        old->buffers.max != new->buffers.max)
+        changes |= CONFIG_CHANGED_BUFFERS;
 
-    UNLOCK_RETURN(0);
+    if (memcmp(&old->rate, &new->rate, sizeof(old->rate)))
+        changes |= CONFIG_CHANGED_RATE;
+
+    if (old->backend_sync != new->backend_sync ||
+        old->frontend_sync != new->frontend_sync ||
+        old->bo_flags != new->bo_flags || old->width != new->width ||
+        old->height != new->height ||
+        memcmp(&old->min_size, &new->min_size, sizeof(old->min_size)) ||
+        memcmp(&old->max_size, &new->max_size, sizeof(old->max_size)) ||
+        old->vk_usage != new->vk_usage ||
+        old->prefer_opaque != new->prefer_opaque ||
+        !funnel_formats_equal(&old->formats, &new->formats))
+        changes |= CONFIG_CHANGED_FORMATS;
+
+    return changes;
 }
 
 int funnel_stream_configure(struct funnel_stream *stream) {
@@ -1200,6 +2369,17 @@ int funnel_stream_configure(struct funnel_stream *stream) {
         return -EINVAL;
     }
 
+    if (stream->config.max_size.width &&
+        (stream->config.width < stream->config.min_size.width ||
+         stream->config.width > stream->config.max_size.width ||
+         stream->config.height < stream->config.min_size.height ||
+         stream->config.height > stream->config.max_size.height)) {
+        pw_log_error("The size set with funnel_stream_set_size() must be "
+                     "within the range set with "
+                     "funnel_stream_set_size_range()");
+        return -EINVAL;
+    }
+
     if (funnel_stream_validate_sync(stream, &stream->config.frontend_sync,
                                     &stream->config.backend_sync)) {
         pw_log_error("The default sync mode is unsupported. Please set a "
@@ -1220,19 +2400,13 @@ int funnel_stream_configure(struct funnel_stream *stream) {
     if (ctx->dead)
         UNLOCK_RETURN(-EIO);
 
-    const char *driver_prio = NULL;
-    bool lazy = false, request = false;
-    switch (stream->config.mode) {
-    case FUNNEL_ASYNC:
-        driver_prio = "1";
-        request = true;
-        break;
-    case FUNNEL_DOUBLE_BUFFERED:
-    case FUNNEL_SINGLE_BUFFERED:
-    case FUNNEL_SYNCHRONOUS:
-        lazy = true;
-        break;
-    }
+    uint32_t changes = CONFIG_CHANGED_ALL;
+    if (stream->stream)
+        changes = config_diff(&stream->cur.config, &stream->config);
+
+    struct funnel_node_props node_props;
+    uint32_t n_items = build_node_props(&stream->config, &node_props);
+    struct spa_dict_item *items = node_props.items;
 
     bool new_stream = false;
     if (!stream->stream) {
@@ -1243,14 +2417,12 @@ int funnel_stream_configure(struct funnel_stream *stream) {
         props = pw_properties_new(
             PW_KEY_MEDIA_TYPE, "Video",
             PW_KEY_MEDIA_CLASS, "Stream/Output/Video",
-            PW_KEY_NODE_NAME, stream->name, 
-            PW_KEY_NODE_SUPPORTS_LAZY, lazy ? "1" : NULL,
-            PW_KEY_NODE_SUPPORTS_REQUEST, request ? "1" : NULL,
-            PW_KEY_PRIORITY_DRIVER, driver_prio,
+            PW_KEY_NODE_NAME, stream->name,
             NULL
         );
         // clang-format on
         assert(props);
+        pw_properties_update(props, &SPA_DICT_INIT(items, n_items));
 
         stream->stream = pw_stream_new(ctx->core, stream->name, props);
         if (!stream->stream) {
@@ -1260,23 +2432,16 @@ int funnel_stream_configure(struct funnel_stream *stream) {
 
         pw_stream_add_listener(stream->stream, &stream->stream_listener,
                                &stream_events, stream);
-    } else {
-        struct pw_properties *props;
-
-        // clang-format off
-        props = pw_properties_new(
-            PW_KEY_NODE_SUPPORTS_LAZY, lazy ? "1" : NULL,
-            PW_KEY_NODE_SUPPORTS_REQUEST, request ? "1" : NULL,
-            PW_KEY_PRIORITY_DRIVER, driver_prio,
-            NULL
-        );
-        // clang-format on
-        assert(props);
-
-        pw_stream_update_properties(stream->stream, &props->dict);
-        pw_properties_free(props);
+    } else if (changes & CONFIG_CHANGED_PROPS) {
+        pw_log_debug("configure: updating node properties");
+        pw_stream_update_properties(stream->stream,
+                                    &SPA_DICT_INIT(items, n_items));
     }
 
+    // Frames queued in FUNNEL_FIFO mode are not sent in other modes
+    if (stream->cur.config.mode != stream->config.mode)
+        fifo_flush(stream);
+
     funnel_free_formats(&stream->cur.config.formats);
     stream->cur.config = stream->config;
     pw_array_init(&stream->cur.config.formats, 32);
@@ -1285,26 +2450,48 @@ int funnel_stream_configure(struct funnel_stream *stream) {
     enum pw_stream_flags flags =
         PW_STREAM_FLAG_ALLOC_BUFFERS | PW_STREAM_FLAG_DRIVER;
 
-    const struct spa_pod **params =
-        calloc(num_formats, sizeof(struct spa_pod *));
+    if (changes & (CONFIG_CHANGED_FORMATS | CONFIG_CHANGED_RATE)) {
+        // A rate change keeps the current format first, so the consumer can
+        // stick to it (and to its buffers) if the negotiated rate is still
+        // acceptable.
+        bool fixate = !new_stream && !(changes & CONFIG_CHANGED_FORMATS) &&
+                      stream->cur.ready;
 
-    int num_params = build_formats(stream, false, params);
-    assert(num_params <= num_formats);
+        const struct spa_pod **params =
+            calloc(num_formats + 1, sizeof(struct spa_pod *));
+
+        int num_params = build_formats(stream, fixate, params);
+        assert(num_params <= num_formats + 1);
+
+        if (!new_stream) {
+            pw_log_debug("configure: updating formats (fixate=%d)", fixate);
+            if (!fixate)
+                stream->cur.ready = false;
+            pw_stream_update_params(stream->stream, params, num_params);
+        } else if (pw_stream_connect(stream->stream, PW_DIRECTION_OUTPUT,
+                                     SPA_ID_INVALID, flags, params,
+                                     num_params) != 0) {
+            free_params(params, num_params);
+            free(params);
+            pw_log_error("failed to connect to stream");
+            pw_stream_destroy(stream->stream);
+            stream->stream = NULL;
+            UNLOCK_RETURN(-EIO);
+        }
 
-    if (!new_stream) {
-        stream->cur.ready = false;
-        pw_stream_update_params(stream->stream, params, num_params);
-    } else if (pw_stream_connect(stream->stream, PW_DIRECTION_OUTPUT,
-                                 SPA_ID_INVALID, flags, params,
-                                 num_params) != 0) {
         free_params(params, num_params);
-        pw_log_error("failed to connect to stream");
-        pw_stream_destroy(stream->stream);
-        stream->stream = NULL;
-        UNLOCK_RETURN(-EIO);
+        free(params);
     }
 
-    free_params(params, num_params);
+    // Buffer parameters are sent once the format is negotiated, so they only
+    // need an update if the current buffer count is no longer acceptable.
+    if (!(changes & CONFIG_CHANGED_FORMATS) &&
+        (changes & CONFIG_CHANGED_BUFFERS) && stream->cur.ready &&
+        (stream->num_buffers < stream->cur.config.buffers.min ||
+         stream->num_buffers > stream->cur.config.buffers.max)) {
+        pw_log_debug("configure: updating buffer parameters");
+        update_buffer_params(stream);
+    }
 
     update_timeouts(stream);
 
@@ -1372,9 +2559,16 @@ void funnel_stream_destroy(struct funnel_stream *stream) {
                                stream->timer);
     }
 
+    if (stream->reconnect) {
+        pw_loop_destroy_source(pw_thread_loop_get_loop(stream->ctx->loop),
+                               stream->reconnect);
+    }
+
     if (stream->funcs && stream->funcs->destroy)
         stream->funcs->destroy(stream);
 
+    spa_list_remove(&stream->ctx_link);
+
     pw_thread_loop_unlock(ctx->loop);
 
     if (stream->dummy_syncobj) {
@@ -1393,6 +2587,75 @@ void funnel_stream_destroy(struct funnel_stream *stream) {
     free(stream);
 }
 
+/// Import the consumer release fence into the dma-buf, for implicit sync
+/// frontends on explicit sync backends.
+static int buffer_import_release_fence(struct funnel_buffer *buf) {
+    struct funnel_stream *stream = buf->stream;
+    int gbm_fd = gbm_device_get_fd(stream->gbm);
+    int fd = -1;
+
+    // A consumer that scheduled the release point might not have attached a
+    // fence to it yet, and it can only be exported once it has one. This
+    // normally happens long before the buffer comes back, so don't wait for
+    // long.
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t deadline = SPA_TIMESPEC_TO_NSEC(&ts) + 100 * SPA_NSEC_PER_MSEC;
+
+    int ret = drmSyncobjTimelineWait(gbm_fd, &buf->acquire.handle,
+                                     &buf->acquire.point, 1, deadline,
+                                     DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+                                     NULL);
+    count_sync_ioctls(stream, 1, 0);
+
+    // Without the fence, the frontend could overwrite the buffer while the
+    // consumer is still reading it, so this is an error.
+    if (ret >= 0)
+        ret = funnel_stream_export_sync_file(stream, buf->acquire.handle,
+                                             buf->acquire.point, &fd);
+    if (ret < 0) {
+        pw_log_error("Failed to export release sync point 0x%x/%lld: %d",
+                     buf->acquire.handle, (long long)buf->acquire.point, ret);
+        return ret;
+    }
+
+    struct dma_buf_import_sync_file args = {
+        .flags = DMA_BUF_SYNC_WRITE,
+        .fd = fd,
+    };
+
+    ret = drmIoctl(buf->fds[0], DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &args);
+    assert(ret >= 0);
+    close(fd);
+    count_sync_ioctls(stream, 1 + sync_transfer_ioctls(stream), 0);
+    return 0;
+}
+
+/// Import the producer's implicit fence into the consumer acquire point,
+/// for implicit sync frontends on explicit sync backends.
+static int buffer_export_acquire_fence(struct funnel_buffer *buf) {
+    struct funnel_stream *stream = buf->stream;
+
+    struct dma_buf_export_sync_file args = {
+        .flags = DMA_BUF_SYNC_READ,
+        .fd = -1,
+    };
+
+    int ret = drmIoctl(buf->fds[0], DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &args);
+    if (ret < 0)
+        return -errno;
+
+    ret = funnel_stream_import_sync_file(stream, buf->release.handle, args.fd,
+                                         buf->release.point);
+    close(args.fd);
+    if (ret < 0)
+        return ret;
+
+    buf->release.point++;
+    count_sync_ioctls(stream, 1 + sync_transfer_ioctls(stream), 0);
+    return 0;
+}
+
 int funnel_stream_dequeue(struct funnel_stream *stream,
                           struct funnel_buffer **pbuf) {
     if (!stream->stream)
@@ -1407,6 +2670,8 @@ int funnel_stream_dequeue(struct funnel_stream *stream,
         UNLOCK_RETURN(-EBUSY);
     }
 
+    clock_resume(stream);
+
     enum pw_stream_state state;
     struct pw_buffer *pwbuffer;
 
@@ -1458,19 +2723,45 @@ int funnel_stream_dequeue(struct funnel_stream *stream,
 
         assert(stream->num_buffers > 0);
 
+        int num_busy = 0;
+        struct pw_buffer *busy[stream->num_buffers];
+
         /*
          * Work around PipeWire weirdness with in-use buffers
          * by trying to dequeue every possible buffer until we
-         * find one that is not in use.
+         * find one that is not in use. Buffers that the API
+         * backend knows are still busy on the GPU are skipped
+         * in favor of idle ones.
          */
         do {
             pwbuffer = pw_stream_dequeue_buffer(stream->stream);
+            if (pwbuffer && !is_buffer_idle(stream, pwbuffer->user_data)) {
+                busy[num_busy++] = pwbuffer;
+                pwbuffer = NULL;
+                errno = EBUSY;
+            }
         } while (!pwbuffer && errno == EBUSY && --retries);
 
+        // If all buffers are busy, use the oldest one (the API backend
+        // will wait for it to become idle).
+        for (int i = 0; i < num_busy; i++) {
+            if (!pwbuffer)
+                pwbuffer = busy[i];
+            else
+                pw_stream_return_buffer(stream->stream, busy[i]);
+        }
+
         if (pwbuffer)
             break;
 
         pw_log_warn("dequeue: out of buffers?");
+
+        // Every buffer was sent, and none ever came back: the consumer
+        // most likely failed to import them.
+        if (!stream->buffer_returned &&
+            stream->frames_sent >= stream->num_buffers)
+            handle_import_failure(stream);
+
         if (stream->cur.config.mode == FUNNEL_ASYNC)
             UNLOCK_RETURN(0);
     }
@@ -1478,26 +2769,49 @@ int funnel_stream_dequeue(struct funnel_stream *stream,
     struct funnel_buffer *buf = pwbuffer->user_data;
     pw_log_trace("  Dequeue buffer %p (%p)", pwbuffer, buf);
 
+    if (buf->sent_count)
+        stream->buffer_returned = true;
+
     assert(!buf->dequeued);
     stream->buffers_dequeued++;
+    stream->dequeued_buffer = buf;
+    // The contents may change from now on, so it can no longer be repeated
+    if (buf == stream->last_sent)
+        stream->last_sent = NULL;
     buf->dequeued = true;
+    buf->late = false;
+
+#ifdef HAVE_EXECINFO_H
+    if (stream->watchdog_ns &&
+        stream->cur.config.mode == FUNNEL_SYNCHRONOUS)
+        stream->dequeue_stack_depth = backtrace(
+            stream->dequeue_stack, ARRAY_SIZE(stream->dequeue_stack));
+#endif
 
     buf->acquire.queried = false;
     buf->release.queried = false;
     buf->release_sync_file_set = false;
-
-    if (buf->backend_sync && !buf->backend_sync_reliable) {
-        int gbm_fd = gbm_device_get_fd(buf->stream->gbm);
-        int ret = drmSyncobjTimelineWait(
-            gbm_fd, &buf->acquire.handle, &buf->acquire.point, 1, 0,
-            DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE, NULL);
-        if (ret < 0) {
-            pw_log_info("Sync point 0x%x/%lld is not materialized, assuming "
-                        "buffer was dropped.",
-                        buf->acquire.handle, (long long)buf->acquire.point);
-            int ret = drmSyncobjTimelineSignal(gbm_fd, &buf->acquire.handle,
-                                               &buf->acquire.point, 1);
-            assert(ret >= 0);
+    buf->pts_set = false;
+    buf->corrupted = false;
+    buf->target_ns = 0;
+
+    // Buffers that were not sent since the last dequeue still have their
+    // (already signaled) acquire point, so there is nothing to check.
+    if (buf->backend_sync && buf->release_pending) {
+        buf->release_pending = false;
+        buffer_check_release_point(buf);
+
+        if (!buf->frontend_sync) {
+            int ret = buffer_import_release_fence(buf);
+            if (ret < 0) {
+                buf->release_pending = true;
+                buf->dequeued = false;
+                stream->buffers_dequeued--;
+                stream->dequeued_buffer = NULL;
+                pw_stream_return_buffer(stream->stream, pwbuffer);
+                unblock_process_thread(stream);
+                UNLOCK_RETURN(ret);
+            }
         }
     }
 
@@ -1515,6 +2829,12 @@ static int funnel_stream_enqueue_internal(struct funnel_stream *stream,
     assert(buf->dequeued);
     buf->dequeued = false;
     stream->buffers_dequeued--;
+    stream->dequeued_buffer = NULL;
+
+    if (buf->late)
+        pw_log_info("enqueue: Frame arrived after a stalled cycle");
+
+    clock_resume(stream);
 
     while (1) {
         if (!buf->pw_buffer) {
@@ -1544,6 +2864,11 @@ static int funnel_stream_enqueue_internal(struct funnel_stream *stream,
             if (stream->pending_buffer)
                 return_buffer(stream, stream->pending_buffer);
             stream->pending_buffer = NULL;
+        } else if (stream->cur.config.mode == FUNNEL_FIFO) {
+            if (valid && stream->fifo.len >= stream->cur.config.fifo_depth) {
+                pw_thread_loop_wait(ctx->loop);
+                continue;
+            }
         } else if (is_buffer_pending(stream)) {
             unblock_process_thread(stream);
             pw_thread_loop_wait(ctx->loop);
@@ -1552,19 +2877,36 @@ static int funnel_stream_enqueue_internal(struct funnel_stream *stream,
         break;
     }
 
+    // Frames that missed the deadline are sent in the next cycle
     if (stream->cur.config.mode == FUNNEL_SYNCHRONOUS &&
-        stream->cycle_state != SYNC_CYCLE_ACTIVE) {
+        stream->cycle_state != SYNC_CYCLE_ACTIVE &&
+        stream->cycle_state != SYNC_CYCLE_LATE) {
         pw_stream_return_buffer(stream->stream, buf->pw_buffer);
         pw_log_info("enqueue: Aborted sync cycle, dropping buffer");
         UNLOCK_RETURN(0);
     }
 
-    assert(!is_buffer_pending(stream));
     if (valid) {
-        stream->pending_buffer = buf;
+        if (!buf->pts_set)
+            buf->pts = buf->target_ns ? buf->target_ns : monotonic_ns();
+        // Frames dropped before being sent leave a gap in the sequence
+        buf->seq = stream->seq++;
+    }
+
+    if (stream->cur.config.mode == FUNNEL_FIFO) {
+        // Returned buffers do not take a cycle, only queued frames do
+        if (valid)
+            fifo_push(stream, buf);
+        else
+            return_buffer(stream, buf);
     } else {
-        stream->skip_buffer = true;
-        return_buffer(stream, buf);
+        assert(!is_buffer_pending(stream));
+        if (valid) {
+            stream->pending_buffer = buf;
+        } else {
+            stream->skip_buffer = true;
+            return_buffer(stream, buf);
+        }
     }
     unblock_process_thread(stream);
 
@@ -1574,6 +2916,65 @@ static int funnel_stream_enqueue_internal(struct funnel_stream *stream,
     UNLOCK_RETURN(valid ? 1 : 0);
 }
 
+static int buffer_import_release_sync_file(struct funnel_buffer *buf, int fd) {
+    if (!buf->backend_sync) {
+        assert(buf->stream->gbm_implicit_sync);
+        struct dma_buf_import_sync_file args = {
+            .flags = DMA_BUF_SYNC_WRITE,
+            .fd = fd,
+        };
+
+        int ret = drmIoctl(buf->fds[0], DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &args);
+        assert(ret >= 0);
+        count_sync_ioctls(buf->stream, 1, 0);
+    } else {
+        pw_log_trace("Release sync point: 0x%x/%lld", buf->release.handle,
+                     (long long)buf->release.point);
+        int ret = funnel_stream_import_sync_file(
+            buf->stream, buf->release.handle, fd, buf->release.point);
+        if (ret < 0)
+            return ret;
+        count_sync_ioctls(buf->stream, sync_transfer_ioctls(buf->stream), 0);
+    }
+
+    return 0;
+}
+
+/// Merge a release sync file into the pending release sync file of a buffer
+static int buffer_merge_release_sync_file(struct funnel_buffer *buf, int fd) {
+    if (buf->pending_release_fd < 0) {
+        buf->pending_release_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (buf->pending_release_fd < 0)
+            return -errno;
+        return 0;
+    }
+
+    struct sync_merge_data args = {
+        .name = "funnel release",
+        .fd2 = fd,
+    };
+
+    int ret = drmIoctl(buf->pending_release_fd, SYNC_IOC_MERGE, &args);
+    if (ret < 0)
+        return -errno;
+    count_sync_ioctls(buf->stream, 1, 0);
+
+    close(buf->pending_release_fd);
+    buf->pending_release_fd = args.fence;
+    return 0;
+}
+
+/// Import the merged release sync file of a buffer, if there is one
+static int buffer_flush_release_sync_file(struct funnel_buffer *buf) {
+    if (buf->pending_release_fd < 0)
+        return 0;
+
+    int ret = buffer_import_release_sync_file(buf, buf->pending_release_fd);
+    close(buf->pending_release_fd);
+    buf->pending_release_fd = -1;
+    return ret;
+}
+
 int funnel_stream_enqueue(struct funnel_stream *stream,
                           struct funnel_buffer *buf) {
     if (!stream->stream)
@@ -1602,6 +3003,12 @@ int funnel_stream_enqueue(struct funnel_stream *stream,
             UNLOCK_RETURN(ret);
     }
 
+    ret = buffer_flush_release_sync_file(buf);
+    if (ret < 0) {
+        pw_log_error("Failed to import release sync file: %d", ret);
+        UNLOCK_RETURN(ret);
+    }
+
     if (buf->frontend_sync) {
         if (!buf->backend_sync && !buf->release_sync_file_set) {
             assert(stream->gbm_implicit_sync);
@@ -1628,14 +3035,32 @@ int funnel_stream_enqueue(struct funnel_stream *stream,
             ret = drmIoctl(buf->fds[0], DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &args);
             assert(ret >= 0);
             close(args.fd);
+            count_sync_ioctls(stream, 1 + sync_transfer_ioctls(stream), 0);
         } else if (buf->backend_sync) {
             buf->release.point++;
         }
+    } else if (buf->backend_sync) {
+        ret = buffer_export_acquire_fence(buf);
+        if (ret < 0) {
+            pw_log_error("Failed to convert implicit sync fence: %d", ret);
+            UNLOCK_RETURN(ret);
+        }
     }
 
     UNLOCK_RETURN(funnel_stream_enqueue_internal(stream, buf, true));
 }
 
+int funnel_stream_enqueue_at(struct funnel_stream *stream,
+                             struct funnel_buffer *buf, uint64_t target_ns) {
+    if (!buf)
+        return -EINVAL;
+    assert(buf->stream == stream);
+
+    buf->target_ns = target_ns;
+
+    return funnel_stream_enqueue(stream, buf);
+}
+
 int funnel_stream_return(struct funnel_stream *stream,
                          struct funnel_buffer *buf) {
     if (!stream->stream)
@@ -1647,11 +3072,17 @@ int funnel_stream_return(struct funnel_stream *stream,
     struct funnel_ctx *ctx = stream->ctx;
     pw_thread_loop_lock(ctx->loop);
 
+    if (buf->pending_release_fd >= 0) {
+        close(buf->pending_release_fd);
+        buf->pending_release_fd = -1;
+    }
+
     if (stream->cur.config.mode == FUNNEL_ASYNC) {
         assert(stream->buffers_dequeued > 0);
         assert(buf->dequeued);
         buf->dequeued = false;
         stream->buffers_dequeued--;
+        stream->dequeued_buffer = NULL;
 
         unblock_process_thread(stream);
 
@@ -1663,6 +3094,25 @@ int funnel_stream_return(struct funnel_stream *stream,
     }
 }
 
+int funnel_stream_repeat_frame(struct funnel_stream *stream) {
+    if (!stream->stream)
+        return -EINVAL;
+
+    struct funnel_ctx *ctx = stream->ctx;
+    pw_thread_loop_lock(ctx->loop);
+
+    if (!stream->last_sent)
+        UNLOCK_RETURN(-ENOENT);
+
+    stream->repeat_frame = true;
+    clock_resume(stream);
+
+    if (stream->cur.config.mode == FUNNEL_ASYNC)
+        pw_stream_trigger_process(stream->stream);
+
+    UNLOCK_RETURN(0);
+}
+
 int funnel_stream_skip_frame(struct funnel_stream *stream) {
     if (!stream->stream)
         return -EINVAL;
@@ -1690,6 +3140,15 @@ void *funnel_buffer_get_user_data(struct funnel_buffer *buf) {
     return buf->opaque;
 }
 
+void funnel_buffer_set_timestamp(struct funnel_buffer *buf, int64_t pts_ns) {
+    buf->pts = pts_ns;
+    buf->pts_set = true;
+}
+
+void funnel_buffer_mark_corrupted(struct funnel_buffer *buf) {
+    buf->corrupted = true;
+}
+
 bool funnel_buffer_has_sync(struct funnel_buffer *buf) {
     return buf->frontend_sync;
 }
@@ -1704,6 +3163,27 @@ int funnel_buffer_get_acquire_sync_object(struct funnel_buffer *buf,
     pw_log_trace("Acquire sync point: 0x%x/%lld", *handle, (long long)*point);
 
     if (!buf->backend_sync) {
+        struct funnel_stream *stream = buf->stream;
+        uint64_t transfer_ioctls = 1 + sync_transfer_ioctls(stream);
+
+        // If the buffer is already idle, the fence imported for the previous
+        // acquisition has signaled too (dma-buf fences are only dropped once
+        // signaled or superseded), so hand out that point again instead of
+        // round-tripping an empty fence through the kernel.
+        struct pollfd pfd = {
+            .fd = buf->fds[0],
+            .events = POLLOUT,
+        };
+        if (buf->acquire.point > 1 && poll(&pfd, 1, 0) == 1 &&
+            (pfd.revents & POLLOUT)) {
+            *point = buf->acquire.point - 1;
+            pw_log_trace("Buffer is idle, reusing acquire sync point %lld",
+                         (long long)*point);
+            count_sync_ioctls(stream, 0, transfer_ioctls);
+            buf->acquire.queried = true;
+            return 0;
+        }
+
         struct dma_buf_export_sync_file args = {
             .flags = DMA_BUF_SYNC_RW,
             .fd = -1,
@@ -1712,11 +3192,12 @@ int funnel_buffer_get_acquire_sync_object(struct funnel_buffer *buf,
         int ret = drmIoctl(buf->fds[0], DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &args);
         assert(ret >= 0);
 
-        ret = funnel_stream_import_sync_file(buf->stream, buf->acquire.handle,
+        ret = funnel_stream_import_sync_file(stream, buf->acquire.handle,
                                              args.fd, buf->acquire.point);
         assert(ret >= 0);
         buf->acquire.point++;
         close(args.fd);
+        count_sync_ioctls(stream, transfer_ioctls, 0);
     }
 
     buf->acquire.queried = true;
@@ -1741,7 +3222,8 @@ int funnel_buffer_get_release_sync_object(struct funnel_buffer *buf,
     return 0;
 }
 
-int funnel_buffer_get_acquire_sync_file(struct funnel_buffer *buf, int *fd) {
+static int buffer_get_acquire_sync_file(struct funnel_buffer *buf, int *fd,
+                                        int64_t timeout) {
     if (!buf->frontend_sync)
         return -EINVAL;
 
@@ -1757,26 +3239,76 @@ int funnel_buffer_get_acquire_sync_file(struct funnel_buffer *buf, int *fd) {
         assert(ret >= 0);
 
         *fd = args.fd;
+        count_sync_ioctls(buf->stream, 1, 0);
     } else {
         pw_log_trace("Acquire sync point: 0x%x/%lld", buf->acquire.handle,
                      (long long)buf->acquire.point);
         int gbm_fd = gbm_device_get_fd(buf->stream->gbm);
         int ret = drmSyncobjTimelineWait(
-            gbm_fd, &buf->acquire.handle, &buf->acquire.point, 1, INT64_MAX,
+            gbm_fd, &buf->acquire.handle, &buf->acquire.point, 1, timeout,
             DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE, NULL);
         if (ret < 0)
-            return -errno;
+            return errno == ETIME ? -EAGAIN : -errno;
 
         ret = funnel_stream_export_sync_file(buf->stream, buf->acquire.handle,
                                              buf->acquire.point, fd);
         if (ret < 0)
             return ret;
+        count_sync_ioctls(buf->stream, 1 + sync_transfer_ioctls(buf->stream),
+                          0);
     }
 
     buf->acquire.queried = true;
     return 0;
 }
 
+int funnel_buffer_get_acquire_sync_file(struct funnel_buffer *buf, int *fd) {
+    return buffer_get_acquire_sync_file(buf, fd, INT64_MAX);
+}
+
+int funnel_buffer_try_get_acquire_sync_file(struct funnel_buffer *buf,
+                                            int *fd) {
+    return buffer_get_acquire_sync_file(buf, fd, 0);
+}
+
+int funnel_buffer_get_acquire_eventfd(struct funnel_buffer *buf, int *fd) {
+    if (!buf->frontend_sync)
+        return -EINVAL;
+
+    *fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (*fd < 0)
+        return -errno;
+
+    // Without backend sync, the acquire sync file is always available
+    if (!buf->backend_sync) {
+        eventfd_write(*fd, 1);
+        return 0;
+    }
+
+#ifdef DRM_IOCTL_SYNCOBJ_EVENTFD
+    struct drm_syncobj_eventfd args = {
+        .handle = buf->acquire.handle,
+        .flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+        .point = buf->acquire.point,
+        .fd = *fd,
+    };
+
+    int gbm_fd = gbm_device_get_fd(buf->stream->gbm);
+    int ret = drmIoctl(gbm_fd, DRM_IOCTL_SYNCOBJ_EVENTFD, &args);
+    if (ret >= 0) {
+        count_sync_ioctls(buf->stream, 1, 0);
+        return 0;
+    }
+    ret = errno == EINVAL || errno == ENOTTY ? -ENOTSUP : -errno;
+#else
+    int ret = -ENOTSUP;
+#endif
+
+    close(*fd);
+    *fd = -1;
+    return ret;
+}
+
 int funnel_buffer_set_release_sync_file(struct funnel_buffer *buf, int fd) {
     if (!buf->frontend_sync)
         return -EINVAL;
@@ -1786,24 +3318,35 @@ int funnel_buffer_set_release_sync_file(struct funnel_buffer *buf, int fd) {
         return -EINVAL;
     }
 
-    if (!buf->backend_sync) {
-        assert(buf->stream->gbm_implicit_sync);
-        struct dma_buf_import_sync_file args = {
-            .flags = DMA_BUF_SYNC_WRITE,
-            .fd = fd,
-        };
+    // Replace any sync files added so far. The result is imported on
+    // enqueue, so that each frame only uses a single release point.
+    if (buf->pending_release_fd >= 0) {
+        close(buf->pending_release_fd);
+        buf->pending_release_fd = -1;
+    }
 
-        int ret = drmIoctl(buf->fds[0], DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &args);
-        assert(ret >= 0);
-    } else {
-        pw_log_trace("Release sync point: 0x%x/%lld", buf->release.handle,
-                     (long long)buf->release.point);
-        int ret = funnel_stream_import_sync_file(
-            buf->stream, buf->release.handle, fd, buf->release.point);
-        if (ret < 0)
-            return ret;
+    int ret = buffer_merge_release_sync_file(buf, fd);
+    if (ret < 0)
+        return ret;
+
+    buf->release_sync_file_set = true;
+    buf->release.queried = true;
+    return 0;
+}
+
+int funnel_buffer_add_release_sync_file(struct funnel_buffer *buf, int fd) {
+    if (!buf->frontend_sync)
+        return -EINVAL;
+
+    if (!buf->release_sync_file_set && buf->release.queried) {
+        pw_log_error("Cannot mix sync file and sync object APIs");
+        return -EINVAL;
     }
 
+    int ret = buffer_merge_release_sync_file(buf, fd);
+    if (ret < 0)
+        return ret;
+
     buf->release_sync_file_set = true;
     buf->release.queried = true;
     return 0;
@@ -7,6 +7,9 @@
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
 
+/// Maximum number of buffers PipeWire allocates for a stream
+#define MAX_BUFFERS 64
+
 #define UNLOCK_RETURN(ret)                                                     \
     do {                                                                       \
         int _ret = ret;                                                        \
@@ -24,6 +27,26 @@ struct funnel_ctx {
     struct pw_core *core;
     struct pw_context *context;
     struct spa_hook core_listener;
+    struct pw_registry *registry;
+    struct spa_hook registry_listener;
+
+    /// Format/modifier pairs that a consumer failed to import
+    struct pw_array bad_modifiers;
+
+    /// All streams created on this context
+    struct spa_list streams;
+    /// Links in the graph, used to count the consumers of each stream
+    struct pw_array links;
+};
+
+struct funnel_link {
+    uint32_t id;
+    uint32_t output_node;
+};
+
+struct funnel_bad_modifier {
+    uint32_t format;
+    uint64_t modifier;
 };
 
 struct funnel_format {
@@ -35,6 +58,7 @@ struct funnel_format {
 
 struct funnel_stream_config {
     enum funnel_mode mode;
+    uint32_t fifo_depth;
     enum funnel_sync backend_sync;
     enum funnel_sync frontend_sync;
     uint32_t bo_flags;
@@ -50,13 +74,48 @@ struct funnel_stream_config {
     uint32_t width;
     uint32_t height;
 
+    struct {
+        uint32_t width, height;
+    } min_size, max_size;
+
     struct pw_array formats;
     bool has_nonlinear_tiling;
+    bool prefer_opaque;
+
+    /// Graph tuning node properties
+    struct {
+        /// Negative for the default of the mode
+        int driver_priority;
+        struct funnel_fraction latency;
+        uint32_t force_rate;
+        char group[64];
+        bool always_process;
+    } node;
 
     // API-specific fields
     uint32_t vk_usage;
 };
 
+/// Maximum number of node properties derived from the stream config
+#define NODE_PROPS_MAX 8
+
+/// Node properties derived from the stream config, with storage for the
+/// formatted values
+struct funnel_node_props {
+    struct spa_dict_item items[NODE_PROPS_MAX];
+    char driver_priority[16];
+    char latency[32];
+    char force_rate[16];
+};
+
+enum funnel_config_change {
+    CONFIG_CHANGED_PROPS = (1 << 0),
+    CONFIG_CHANGED_BUFFERS = (1 << 1),
+    CONFIG_CHANGED_RATE = (1 << 2),
+    CONFIG_CHANGED_FORMATS = (1 << 3),
+    CONFIG_CHANGED_ALL = 0xf,
+};
+
 enum funnel_api {
     API_UNSET = 0,
     API_GBM,
@@ -68,6 +127,7 @@ struct funnel_stream_funcs {
     void (*alloc_buffer)(struct funnel_buffer *);
     void (*free_buffer)(struct funnel_buffer *);
     int (*enqueue_buffer)(struct funnel_buffer *);
+    bool (*buffer_is_idle)(struct funnel_buffer *);
     void (*destroy)(struct funnel_stream *);
 };
 
@@ -75,6 +135,8 @@ enum funnel_sync_cycle {
     SYNC_CYCLE_INACTIVE,
     SYNC_CYCLE_WAITING,
     SYNC_CYCLE_ACTIVE,
+    /// The cycle went on without a frame, which goes out in the next one
+    SYNC_CYCLE_LATE,
 };
 
 struct funnel_sync_point {
@@ -85,11 +147,16 @@ struct funnel_sync_point {
 
 struct funnel_stream {
     struct funnel_ctx *ctx;
+    struct spa_list ctx_link;
     const char *name;
     enum funnel_api api;
     funnel_buffer_callback alloc_cb;
     funnel_buffer_callback free_cb;
     void *cb_opaque;
+    funnel_rate_callback rate_cb;
+    void *rate_cb_opaque;
+    /// Last frame rate reported to rate_cb
+    struct spa_fraction reported_rate;
     uint32_t frame;
 
     const struct funnel_stream_funcs *funcs;
@@ -107,6 +174,22 @@ struct funnel_stream {
     struct spa_hook stream_listener;
     struct pw_stream *stream;
     struct spa_source *timer;
+    struct spa_source *reconnect;
+
+    /// Absolute-deadline driver clock. Deadline n is at
+    /// base_ns + n * rate.denom * 1e9 / rate.num (CLOCK_MONOTONIC).
+    struct {
+        bool active;
+        struct spa_fraction rate;
+        uint64_t base_ns;
+        uint64_t cycle;
+        /// Last external reference timestamp, 0 if none
+        uint64_t ref_ns;
+        /// Suspend after this many cycles without a frame, 0 to never
+        uint32_t idle_timeout;
+        uint32_t idle_cycles;
+        bool suspended;
+    } clock;
 
     struct funnel_stream_config config;
     bool config_pending;
@@ -117,11 +200,50 @@ struct funnel_stream {
     bool active;
     int num_buffers;
     enum funnel_sync_cycle cycle_state;
+    /// Budget for the application to submit a frame in a sync cycle
+    uint64_t sync_deadline_ns;
+    /// The active sync cycle waits with a timeout instead of for accept
+    bool cycle_timed;
+    /// Stall threshold for sync cycles, with the call stack of the last
+    /// dequeue for diagnostics
+    uint64_t watchdog_ns;
+    void *dequeue_stack[16];
+    int dequeue_stack_depth;
     int buffers_dequeued;
+    struct funnel_buffer *dequeued_buffer;
     struct funnel_buffer *pending_buffer;
     bool skip_buffer;
+    /// Most recently sent buffer, and whether to send it again
+    struct funnel_buffer *last_sent;
+    bool repeat_frame;
     int skip_frames;
 
+    /// Queued frames in FUNNEL_FIFO mode
+    struct {
+        struct spa_list queue;
+        uint32_t len;
+        /// Frames to accumulate before draining, adapted to the jitter
+        uint32_t target;
+        bool priming;
+        uint64_t last_ns;
+        uint64_t jitter_ns;
+    } fifo;
+
+    /// Header meta state: next frame sequence number, and whether the next
+    /// sent frame follows a discontinuity
+    uint64_t seq;
+    bool discont;
+
+    /// More than one consumer is linked to the stream
+    bool fanout;
+
+    /// Import failure detection for the current format
+    int frames_sent;
+    bool buffer_returned;
+
+    /// Cumulative counters, updated atomically from any thread
+    struct funnel_stream_stats stats;
+
     struct {
         struct funnel_stream_config config;
         bool ready;
@@ -143,7 +265,12 @@ struct funnel_buffer {
     struct funnel_stream *stream;
     struct pw_buffer *pw_buffer;
     struct spa_meta_sync_timeline *stl;
+    struct spa_meta_header *header;
+    struct spa_list queue_link;
+    bool queued;
     bool dequeued;
+    /// Still dequeued when the watchdog broke a stalled cycle
+    bool late;
     bool driving;
     uint32_t width;
     uint32_t height;
@@ -154,10 +281,22 @@ struct funnel_buffer {
 
     bool backend_sync;
     bool backend_sync_reliable;
+    /// Sent to the consumer, release point not yet checked
+    bool release_pending;
     bool frontend_sync;
     struct funnel_sync_point acquire;
     struct funnel_sync_point release;
     bool release_sync_file_set;
+    /// Release sync files merged so far, imported on enqueue
+    int pending_release_fd;
+
+    /// Frame metadata for the header meta
+    int64_t pts;
+    bool pts_set;
+    bool corrupted;
+    uint64_t seq;
+    /// Hold the frame until the cycle closest to this time, 0 if none
+    uint64_t target_ns;
 
     /// Workaround for nouveau/NVK dma-buf bug?
     uint64_t sent_count;
@@ -10,6 +10,7 @@
 #include <poll.h>
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
+#include <xf86drm.h>
 
 PW_LOG_TOPIC_STATIC(log_funnel_vk, "funnel.vk");
 #define PW_LOG_TOPIC_DEFAULT log_funnel_vk
@@ -26,6 +27,7 @@ struct funnel_vk_stream {
     PFN_vkImportSemaphoreFdKHR vkImportSemaphoreFdKHR;
 
     bool dmabuf_workaround;
+    bool timeline_semaphores;
 };
 
 struct funnel_vk_buffer {
@@ -33,9 +35,12 @@ struct funnel_vk_buffer {
     VkDeviceMemory mem;
     VkSemaphore acquire;
     VkSemaphore release;
+    /// acquire/release are timeline semaphores imported from the syncobjs
+    bool timeline;
     VkFence fence;
     bool fence_queried;
     int last_sync_file;
+    struct spa_source *idle_source;
 };
 
 static uint32_t format_vk_to_gbm(VkFormat format, bool alpha) {
@@ -191,6 +196,50 @@ int funnel_stream_vk_add_format(struct funnel_stream *stream, VkFormat format,
     return ret;
 }
 
+static bool import_timeline_semaphore(struct funnel_buffer *buffer,
+                                      uint32_t handle, VkSemaphore *psem) {
+    struct funnel_vk_stream *vks = buffer->stream->api_ctx;
+    int gbm_fd = gbm_device_get_fd(buffer->stream->gbm);
+    VkSemaphore sem;
+    int fd;
+
+    VkSemaphoreTypeCreateInfo type_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+
+    VkSemaphoreCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &type_info,
+    };
+
+    if (vkCreateSemaphore(vks->device, &create_info, NULL, &sem) != VK_SUCCESS)
+        return false;
+
+    if (drmSyncobjHandleToFD(gbm_fd, handle, &fd) < 0) {
+        vkDestroySemaphore(vks->device, sem, NULL);
+        return false;
+    }
+
+    VkImportSemaphoreFdInfoKHR info = {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR,
+        .semaphore = sem,
+        .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
+        .fd = fd,
+    };
+
+    // On success, the fd is owned by the Vulkan implementation
+    if (vks->vkImportSemaphoreFdKHR(vks->device, &info) != VK_SUCCESS) {
+        close(fd);
+        vkDestroySemaphore(vks->device, sem, NULL);
+        return false;
+    }
+
+    *psem = sem;
+    return true;
+}
+
 void funnel_vk_alloc_buffer(struct funnel_buffer *buffer) {
     struct funnel_stream *stream = buffer->stream;
     struct funnel_vk_stream *vks = stream->api_ctx;
@@ -306,6 +355,21 @@ void funnel_vk_alloc_buffer(struct funnel_buffer *buffer) {
     vkbuf->mem = mem;
     vkbuf->last_sync_file = -1;
 
+    if (vks->timeline_semaphores) {
+        if (import_timeline_semaphore(buffer, buffer->acquire.handle,
+                                      &vkbuf->acquire)) {
+            if (import_timeline_semaphore(buffer, buffer->release.handle,
+                                          &vkbuf->release))
+                vkbuf->timeline = true;
+            else
+                vkDestroySemaphore(vks->device, vkbuf->acquire, NULL);
+        }
+
+        if (!vkbuf->timeline)
+            pw_log_warn("Failed to import sync objects as timeline "
+                        "semaphores, falling back to sync files");
+    }
+
     VkExportSemaphoreCreateInfo export_info = {
         .sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO,
         .handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
@@ -320,13 +384,15 @@ void funnel_vk_alloc_buffer(struct funnel_buffer *buffer) {
         .pNext = &export_info,
     };
 
-    res =
-        vkCreateSemaphore(vks->device, &create_acquire, NULL, &vkbuf->acquire);
-    assert(res == VK_SUCCESS);
+    if (!vkbuf->timeline) {
+        res = vkCreateSemaphore(vks->device, &create_acquire, NULL,
+                                &vkbuf->acquire);
+        assert(res == VK_SUCCESS);
 
-    res =
-        vkCreateSemaphore(vks->device, &create_release, NULL, &vkbuf->release);
-    assert(res == VK_SUCCESS);
+        res = vkCreateSemaphore(vks->device, &create_release, NULL,
+                                &vkbuf->release);
+        assert(res == VK_SUCCESS);
+    }
 
     VkFenceCreateInfo create_fence = {
         .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
@@ -340,19 +406,68 @@ void funnel_vk_alloc_buffer(struct funnel_buffer *buffer) {
     assert(funnel_buffer_has_sync(buffer));
 }
 
-static void buffer_wait_idle(struct funnel_vk_stream *vks,
-                             struct funnel_vk_buffer *vkbuf) {
-    if (vkbuf->last_sync_file != -1) {
+/*
+ * Stop watching the last release sync file of a buffer, and return it.
+ * Must be called with the loop lock held.
+ */
+static int take_last_sync_file(struct funnel_buffer *buffer) {
+    struct funnel_vk_buffer *vkbuf = buffer->api_buf;
+    int fd = vkbuf->last_sync_file;
+
+    if (vkbuf->idle_source) {
+        pw_loop_destroy_source(
+            pw_thread_loop_get_loop(buffer->stream->ctx->loop),
+            vkbuf->idle_source);
+        vkbuf->idle_source = NULL;
+    }
+    vkbuf->last_sync_file = -1;
+
+    return fd;
+}
+
+static void on_buffer_idle(void *data, int fd, uint32_t mask) {
+    struct funnel_buffer *buffer = data;
+
+    pw_log_trace("Buffer %p is idle", buffer);
+    // Nothing waits for this: dequeue just prefers idle buffers, and
+    // buffer_wait_idle() polls the sync file itself if it is still set.
+    close(take_last_sync_file(buffer));
+}
+
+static bool funnel_vk_buffer_is_idle(struct funnel_buffer *buffer) {
+    struct funnel_vk_stream *vks = buffer->stream->api_ctx;
+    struct funnel_vk_buffer *vkbuf = buffer->api_buf;
+
+    // There is no release sync file to watch with timeline semaphores
+    if (vkbuf->timeline)
+        return vkGetFenceStatus(vks->device, vkbuf->fence) == VK_SUCCESS;
+
+    return vkbuf->last_sync_file == -1;
+}
+
+static void buffer_wait_idle(struct funnel_buffer *buffer) {
+    struct funnel_vk_stream *vks = buffer->stream->api_ctx;
+    struct funnel_vk_buffer *vkbuf = buffer->api_buf;
+    struct pw_thread_loop *loop = buffer->stream->ctx->loop;
+
+    // Normally, the loop thread has already seen the sync file signal by
+    // the time the buffer is dequeued again, so this does not block.
+    pw_thread_loop_lock(loop);
+    int fd = take_last_sync_file(buffer);
+    pw_thread_loop_unlock(loop);
+
+    if (fd != -1) {
+        pw_log_debug("Waiting for buffer %p to become idle", buffer);
+
         struct pollfd pfd = {
-            .fd = vkbuf->last_sync_file,
+            .fd = fd,
             .events = POLLIN,
         };
 
         assert(poll(&pfd, 1, -1) == 1);
         assert(pfd.revents & POLLIN);
 
-        close(vkbuf->last_sync_file);
-        vkbuf->last_sync_file = -1;
+        close(fd);
     }
     VkResult res =
         vkWaitForFences(vks->device, 1, &vkbuf->fence, 1, UINT64_MAX);
@@ -365,7 +480,7 @@ void funnel_vk_free_buffer(struct funnel_buffer *buffer) {
     struct funnel_vk_stream *vks = buffer->stream->api_ctx;
     struct funnel_vk_buffer *vkbuf = buffer->api_buf;
 
-    buffer_wait_idle(vks, vkbuf);
+    buffer_wait_idle(buffer);
     vkDestroyFence(vks->device, vkbuf->fence, NULL);
     vkDestroySemaphore(vks->device, vkbuf->acquire, NULL);
     vkDestroySemaphore(vks->device, vkbuf->release, NULL);
@@ -389,23 +504,38 @@ int funnel_vk_enqueue_buffer(struct funnel_buffer *buf) {
         return -EINVAL;
     }
 
-    // Reset for GBM layer to take over
-    buf->release.queried = false;
+    int ret = 0;
 
-    VkSemaphoreGetFdInfoKHR info = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
-        .semaphore = vkbuf->release,
-        .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
-    };
+    // With timeline semaphores, the application signals the release
+    // point directly.
+    if (!vkbuf->timeline) {
+        // Reset for GBM layer to take over
+        buf->release.queried = false;
 
-    int fd;
-    if (vks->vkGetSemaphoreFdKHR(vks->device, &info, &fd) != VK_SUCCESS) {
-        pw_log_error("Failed to export sync file from semaphore");
-        return -EIO;
+        VkSemaphoreGetFdInfoKHR info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
+            .semaphore = vkbuf->release,
+            .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
+        };
+
+        int fd;
+        if (vks->vkGetSemaphoreFdKHR(vks->device, &info, &fd) != VK_SUCCESS) {
+            pw_log_error("Failed to export sync file from semaphore");
+            return -EIO;
+        }
+
+        // Merged with any sync files the application added
+        ret = funnel_buffer_add_release_sync_file(buf, fd);
+        vkbuf->last_sync_file = fd;
+
+        // Track completion on the loop thread, so that dequeue can prefer
+        // buffers that are already idle (called with the loop lock held).
+        vkbuf->idle_source =
+            pw_loop_add_io(pw_thread_loop_get_loop(buf->stream->ctx->loop), fd,
+                           SPA_IO_IN, false, on_buffer_idle, buf);
+        assert(vkbuf->idle_source);
     }
 
-    int ret = funnel_buffer_set_release_sync_file(buf, fd);
-    vkbuf->last_sync_file = fd;
     vkbuf->fence_queried = false;
 
     /// Nouveau/NVK dma-buf migration issue workaround
@@ -485,6 +615,7 @@ static const struct funnel_stream_funcs vk_funcs = {
     .alloc_buffer = funnel_vk_alloc_buffer,
     .free_buffer = funnel_vk_free_buffer,
     .enqueue_buffer = funnel_vk_enqueue_buffer,
+    .buffer_is_idle = funnel_vk_buffer_is_idle,
     .destroy = funnel_vk_destroy,
 };
 
@@ -629,12 +760,18 @@ int funnel_buffer_get_vk_semaphores(struct funnel_buffer *buf,
     struct funnel_vk_buffer *vkbuf = buf->api_buf;
     struct funnel_vk_stream *vks = buf->stream->api_ctx;
 
+    if (vkbuf->timeline) {
+        pw_log_error("Buffer uses timeline semaphores, use "
+                     "funnel_buffer_get_vk_timeline_semaphores()");
+        return -EINVAL;
+    }
+
     // Can only be called once per buffer
     if (buf->acquire.queried)
         return -EBUSY;
 
     // Wait for previous use to be complete
-    buffer_wait_idle(vks, vkbuf);
+    buffer_wait_idle(buf);
 
     int fd;
     int ret = funnel_buffer_get_acquire_sync_file(buf, &fd);
@@ -661,6 +798,77 @@ int funnel_buffer_get_vk_semaphores(struct funnel_buffer *buf,
     return 0;
 }
 
+int funnel_buffer_get_vk_timeline_semaphores(struct funnel_buffer *buf,
+                                             VkSemaphore *acquire,
+                                             uint64_t *acquire_point,
+                                             VkSemaphore *release,
+                                             uint64_t *release_point) {
+    if (!buf || buf->stream->api != API_VULKAN)
+        return -EINVAL;
+
+    struct funnel_vk_buffer *vkbuf = buf->api_buf;
+
+    if (!vkbuf->timeline)
+        return -EINVAL;
+
+    // Can only be called once per buffer
+    if (buf->acquire.queried)
+        return -EBUSY;
+
+    uint32_t handle;
+    int ret = funnel_buffer_get_acquire_sync_object(buf, &handle, acquire_point);
+    if (ret < 0)
+        return ret;
+
+    ret = funnel_buffer_get_release_sync_object(buf, &handle, release_point);
+    if (ret < 0)
+        return ret;
+
+    *acquire = vkbuf->acquire;
+    *release = vkbuf->release;
+    return 0;
+}
+
+int funnel_stream_vk_set_timeline_semaphores(struct funnel_stream *stream,
+                                             bool enable) {
+    if (!stream || stream->api != API_VULKAN)
+        return -EINVAL;
+
+    struct funnel_vk_stream *vks = stream->api_ctx;
+
+    if (enable) {
+        if (!stream->gbm_timeline_sync)
+            return -ENOTSUP;
+
+        VkSemaphoreTypeCreateInfo type_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        };
+
+        VkPhysicalDeviceExternalSemaphoreInfo info = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO,
+            .pNext = &type_info,
+            .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT,
+        };
+
+        VkExternalSemaphoreProperties props = {
+            .sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES,
+        };
+
+        vkGetPhysicalDeviceExternalSemaphoreProperties(vks->physical_device,
+                                                       &info, &props);
+
+        if (!(props.externalSemaphoreFeatures &
+              VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT)) {
+            pw_log_error("Timeline semaphore import is not supported");
+            return -ENOTSUP;
+        }
+    }
+
+    vks->timeline_semaphores = enable;
+    return 0;
+}
+
 int funnel_buffer_get_vk_fence(struct funnel_buffer *buf, VkFence *fence) {
     if (!buf || buf->stream->api != API_VULKAN)
         return -EINVAL;
@@ -673,7 +881,7 @@ int funnel_buffer_get_vk_fence(struct funnel_buffer *buf, VkFence *fence) {
         return -EBUSY;
 
     // Wait for previous use to be complete
-    buffer_wait_idle(vks, vkbuf);
+    buffer_wait_idle(buf);
 
     if (vkResetFences(vks->device, 1, &vkbuf->fence) != VK_SUCCESS) {
         pw_log_error("vkResetFences failed");